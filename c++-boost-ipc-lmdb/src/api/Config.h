@@ -22,7 +22,9 @@ namespace rinhaback::api
 		static inline const auto instanceId = static_cast<unsigned>(std::stoul(readEnv("INSTANCE_ID", "0")));
 		static inline const auto workers = static_cast<unsigned>(std::stoul(readEnv("WORKERS", "8")));
 		static inline const auto database = readEnv("DATABASE", "/data/database");
-		static inline const auto databaseSize = static_cast<unsigned>(std::stoul(readEnv("DATABASE_SIZE", "10485760")));
+		static inline const auto databaseSize = static_cast<unsigned>(std::stoul(readEnv("DATABASE_SIZE", "0")));
+		static inline const auto expectedPaymentRate =
+			static_cast<unsigned>(std::stoul(readEnv("EXPECTED_PAYMENT_RATE", "300")));
 		static inline const auto coordinator = instanceId == 0;
 		static inline const auto listenAddress = readEnv("LISTEN_ADDRESS", "0.0.0.0:8080");
 		static inline const auto processorDefaultAddress =
@@ -2,8 +2,11 @@
 
 #include <array>
 #include <format>
+#include <map>
 #include <print>
+#include <shared_mutex>
 #include <utility>
+#include <cstddef>
 #include <cstdint>
 #include "lmdb.h"
 
@@ -53,9 +56,21 @@ namespace rinhaback::api
 		Connection(const Connection&) = delete;
 		Connection& operator=(const Connection&) = delete;
 
+	public:
+		// Grows the map after a write failed with MDB_MAP_FULL, unless it was already grown since that write began
+		void growMap(std::size_t fullMapSize);
+
+		// Adopts the map size set by another process, after MDB_MAP_RESIZED
+		void adoptMapSize();
+
 	public:
 		MDB_env* env;
 		std::array<MDB_dbi, std::to_underlying(PaymentGateway::SIZE)> dbis;
+
+		// Held shared by the transactions and exclusively to change the map size, which LMDB only allows while the
+		// process has no active transaction
+		std::shared_mutex mapMutex;
+		std::size_t mapSize = 0;
 	};
 
 	class Transaction final
@@ -63,13 +78,27 @@ namespace rinhaback::api
 	public:
 		explicit Transaction(Connection& connection, int flags)
 			: connection(connection),
-			  flags(flags)
+			  flags(flags),
+			  mapLock(connection.mapMutex)
 		{
-			checkMdbError(mdb_txn_begin(connection.env, nullptr, flags, &txn));
+			int rc;
+
+			while ((rc = mdb_txn_begin(connection.env, nullptr, flags, &txn)) == MDB_MAP_RESIZED)
+			{
+				mapLock.unlock();
+				connection.adoptMapSize();
+				mapLock.lock();
+			}
+
+			checkMdbError(rc);
+			mapSize = connection.mapSize;
 		}
 
 		~Transaction()
 		{
+			if (!txn)
+				return;
+
 			if (flags & MDB_RDONLY)
 				mdb_txn_abort(txn);
 			else
@@ -80,9 +109,146 @@ namespace rinhaback::api
 		Transaction& operator=(const Transaction&) = delete;
 
 	public:
+		// Ends the transaction before its destruction, returning the result of the commit
+		int commit()
+		{
+			const int rc = mdb_txn_commit(txn);
+			txn = nullptr;
+			mapLock.unlock();
+			return rc;
+		}
+
+		void abort()
+		{
+			mdb_txn_abort(txn);
+			txn = nullptr;
+			mapLock.unlock();
+		}
+
 		Connection& connection;
 		MDB_txn* txn;
 		const int flags;
+		std::size_t mapSize;
+
+	private:
+		std::shared_lock<std::shared_mutex> mapLock;
+	};
+
+	// Read-only transaction taken from the ones each thread keeps for each connection. Destroying it only resets
+	// the transaction, which releases its snapshot but keeps its slot in the reader table, so the next use renews
+	// it and its cursors instead of beginning a new one.
+	class ReadTransaction final
+	{
+	private:
+		struct Cache final
+		{
+			Cache() = default;
+
+			Cache(const Cache&) = delete;
+			Cache& operator=(const Cache&) = delete;
+
+			~Cache()
+			{
+				close();
+			}
+
+			// Begins or renews the transaction and its cursors, discarding them when that fails
+			int begin(MDB_env* env)
+			{
+				int rc;
+
+				if (!txn)
+					rc = mdb_txn_begin(env, nullptr, MDB_RDONLY, &txn);
+				else
+				{
+					rc = mdb_txn_renew(txn);
+
+					for (const auto cursor : cursors)
+					{
+						if (rc == 0 && cursor)
+							rc = mdb_cursor_renew(txn, cursor);
+					}
+
+					if (rc != 0)
+						close();
+				}
+
+				return rc;
+			}
+
+			void close()
+			{
+				for (auto& cursor : cursors)
+				{
+					if (cursor)
+						mdb_cursor_close(cursor);
+
+					cursor = nullptr;
+				}
+
+				if (txn)
+					mdb_txn_abort(txn);
+
+				txn = nullptr;
+			}
+
+			MDB_txn* txn = nullptr;
+			std::array<MDB_cursor*, std::to_underlying(PaymentGateway::SIZE)> cursors{};
+		};
+
+	public:
+		explicit ReadTransaction(Connection& connection)
+			: connection(connection),
+			  cache(getCache(connection)),
+			  mapLock(connection.mapMutex)
+		{
+			int rc;
+
+			while ((rc = cache.begin(connection.env)) == MDB_MAP_RESIZED)
+			{
+				mapLock.unlock();
+				connection.adoptMapSize();
+				mapLock.lock();
+			}
+
+			checkMdbError(rc);
+
+			txn = cache.txn;
+		}
+
+		~ReadTransaction()
+		{
+			mdb_txn_reset(txn);
+		}
+
+		ReadTransaction(const ReadTransaction&) = delete;
+		ReadTransaction& operator=(const ReadTransaction&) = delete;
+
+	public:
+		MDB_cursor* getCursor(PaymentGateway gateway)
+		{
+			auto& cursor = cache.cursors[std::to_underlying(gateway)];
+
+			if (!cursor)
+				checkMdbError(mdb_cursor_open(txn, connection.dbis[std::to_underlying(gateway)], &cursor));
+
+			return cursor;
+		}
+
+	private:
+		static Cache& getCache(const Connection& connection)
+		{
+			thread_local std::map<const Connection*, Cache> caches;
+			return caches[&connection];
+		}
+
+	public:
+		Connection& connection;
+		MDB_txn* txn;
+
+	private:
+		Cache& cache;
+		std::shared_lock<std::shared_mutex> mapLock;
 	};
 
 	inline Connection& getConnection()
@@ -19,61 +19,50 @@ namespace rinhaback::api
 
 		PaymentData data{.amount = amount, .correlationId = correlationId};
 
-		Transaction transaction(connection, 0);
-
 		MDB_val mdbKey(sizeof(key), &key);
 		MDB_val mdbData(sizeof(data), &data);
-		checkMdbError(mdb_put(transaction.txn, connection.dbis[std::to_underlying(gateway)], &mdbKey, &mdbData, 0));
-	}
-
-	PaymentsGatewaySummaryResponse PaymentRepository::getPaymentsSummary(
-		Transaction& transaction, std::optional<std::int64_t> from, std::optional<std::int64_t> to)
-	{
-		auto& connection = transaction.connection;
-
-		PaymentsGatewaySummaryResponse response = {
-			.totalRequests = 0,
-			.totalAmount = 0.0,
-		};
-
-		PaymentKey initialKey{.dateTime = from.value_or(0)};
-
-		MDB_val mdbKey(sizeof(initialKey), &initialKey);
-		MDB_val mdbData;
-
-		MDB_cursor* cursor;
-		checkMdbError(mdb_cursor_open(transaction.txn, connection.dbis[std::to_underlying(gateway)], &cursor));
-
-		int rc = mdb_cursor_get(cursor, &mdbKey, &mdbData, (from ? MDB_SET_RANGE : MDB_FIRST));
 
-		if (rc != 0)
+		while (true)
 		{
-			mdb_cursor_close(cursor);
+			Transaction transaction(connection, 0);
+			const auto dbi = connection.dbis[std::to_underlying(gateway)];
 
-			if (rc != MDB_NOTFOUND)
-				checkMdbError(rc);
+			// Timestamps mostly arrive in order, and appending skips the B-tree descent and fills the last page
+			// instead of splitting it in half. Keys not after the last one, including a repeated last key, are
+			// refused with MDB_KEYEXIST and take the regular path.
+			int rc = mdb_put(transaction.txn, dbi, &mdbKey, &mdbData, MDB_APPEND);
 
-			return response;
-		}
+			if (rc == MDB_KEYEXIST)
+				rc = mdb_put(transaction.txn, dbi, &mdbKey, &mdbData, 0);
 
-		while (rc == 0)
-		{
-			const auto* key = static_cast<const PaymentKey*>(mdbKey.mv_data);
-			const auto* data = static_cast<const PaymentData*>(mdbData.mv_data);
+			if (rc == 0)
+				rc = transaction.commit();
+			else
+				transaction.abort();
 
-			if (to.has_value() && key->dateTime > to.value())
+			if (rc != MDB_MAP_FULL)
 			{
-				rc = MDB_NOTFOUND;
+				checkMdbError(rc);
 				break;
 			}
 
-			++response.totalRequests;
-			response.totalAmount += data->amount;
-
-			rc = mdb_cursor_get(cursor, &mdbKey, &mdbData, MDB_NEXT);
+			// Written again after the map is grown
+			connection.growMap(transaction.mapSize);
 		}
+	}
+
+	PaymentsGatewaySummaryResponse PaymentRepository::getPaymentsSummary(
+		ReadTransaction& transaction, std::optional<std::int64_t> from, std::optional<std::int64_t> to)
+	{
+		PaymentsGatewaySummaryResponse response = {
+			.totalRequests = 0,
+			.totalAmount = 0.0,
+		};
+
+		// Owned by the transaction cache, so it's not closed here
+		const auto cursor = transaction.getCursor(gateway);
 
-		mdb_cursor_close(cursor);
+		const int rc = sumPayments(cursor, from, to, response);
 
 		if (rc != MDB_NOTFOUND)
 			checkMdbError(rc);
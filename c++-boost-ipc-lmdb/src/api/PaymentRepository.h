@@ -1,6 +1,7 @@
 #pragma once
 
 #include "./Database.h"
+#include "../common/PaymentRecords.h"
 #include "../common/Types.h"
 #include "../common/Util.h"
 #include <optional>
@@ -11,18 +12,6 @@ namespace rinhaback::api
 {
 	class PaymentRepository final
 	{
-	private:
-		struct __attribute__((packed)) PaymentKey final
-		{
-			std::int64_t dateTime;
-		};
-
-		struct __attribute__((packed)) PaymentData final
-		{
-			double amount;
-			CorrelationId correlationId;
-		};
-
 	public:
 		PaymentRepository(PaymentGateway gateway)
 			: gateway(gateway)
@@ -36,7 +25,7 @@ namespace rinhaback::api
 		void postPayment(double amount, const CorrelationId& correlationId, DateTimeMillis requestedAt);
 
 		PaymentsGatewaySummaryResponse getPaymentsSummary(
-			Transaction& transaction, std::optional<std::int64_t> from, std::optional<std::int64_t> to);
+			ReadTransaction& transaction, std::optional<std::int64_t> from, std::optional<std::int64_t> to);
 
 		void purge();
 
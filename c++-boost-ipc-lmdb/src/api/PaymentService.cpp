@@ -20,7 +20,7 @@ namespace rinhaback::api
 			to.has_value() ? std::make_optional(to->time_since_epoch().count()) : std::nullopt;
 
 		Connection& connection = getConnection();
-		Transaction transaction(connection, MDB_RDONLY);
+		ReadTransaction transaction(connection);
 
 		PaymentsSummaryResponse response{
 			.defaultGateway = repositories[std::to_underlying(PaymentGateway::DEFAULT)].getPaymentsSummary(
@@ -6,6 +6,7 @@
 #include <mutex>
 #include <optional>
 #include <queue>
+#include <span>
 #include <cassert>
 #include <cstdint>
 
@@ -38,6 +39,21 @@ namespace rinhaback::api
 			condVar.notify_one();
 		}
 
+		void enqueue(std::span<const Payment> payments)
+		{
+			{  // scope
+				std::unique_lock lock(mutex);
+
+				for (const auto& payment : payments)
+					queue.push(payment);
+			}
+
+			if (payments.size() == 1)
+				condVar.notify_one();
+			else
+				condVar.notify_all();
+		}
+
 		std::optional<Payment> dequeue()
 		{
 			do
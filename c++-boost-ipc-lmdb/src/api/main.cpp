@@ -7,11 +7,11 @@
 #include "./SignalHandling.h"
 #include "../common/Protocol.h"
 #include "../common/Util.h"
-#include <atomic>
+#include <array>
 #include <format>
 #include <memory>
-#include <optional>
 #include <print>
+#include <span>
 #include <thread>
 #include <vector>
 #include "boost/asio.hpp"
@@ -31,41 +31,51 @@ namespace
 
 	void handler()
 	{
-		static std::atomic_uint handlerCounter;
-		const auto handlerId = handlerCounter++;
-
-		auto ipcMessage = &ipcConnection->header->items[handlerId];
-
 		do
 		{
-			ipcMessage->requestReady.wait();
+			const auto request = ipcConnection->receive();
 
-			switch (ipcMessage->messageType)
+			switch (request.messageType)
 			{
 				case IpcMessageType::REQUEST_POST_PAYMENT:
 				{
-					const PendingPaymentsQueue::Payment payment{.amount = ipcMessage->postPaymentRequest.amount,
-						.correlationId = ipcMessage->postPaymentRequest.correlationId};
+					const PendingPaymentsQueue::Payment payment{.amount = request.postPaymentRequest.amount,
+						.correlationId = request.postPaymentRequest.correlationId};
 
 					pendingPaymentsQueue->enqueue(payment);
 					break;
 				}
 
+				case IpcMessageType::REQUEST_POST_PAYMENTS_BATCH:
+				{
+					const auto& batch = request.postPaymentsBatchRequest;
+					std::array<PendingPaymentsQueue::Payment, IpcRequest::MAX_PAYMENTS_BATCH> payments;
+
+					for (uint32_t i = 0; i < batch.count; ++i)
+					{
+						const auto& payment = batch.payments[i];
+						payments[i] = {.amount = payment.amount, .correlationId = payment.correlationId};
+					}
+
+					pendingPaymentsQueue->enqueue(std::span(payments.data(), batch.count));
+					break;
+				}
+
 				case IpcMessageType::REQUEST_PAYMENTS_SUMMARY:
-					ipcMessage->paymentsSummaryResponse = paymentService->getPaymentsSummary(
-						ipcMessage->paymentsSummaryRequest.from, ipcMessage->paymentsSummaryRequest.to);
-					ipcMessage->responseReady.post();
+					ipcConnection->getResponseSlot(request.responseSlot).paymentsSummaryResponse =
+						paymentService->getPaymentsSummary(
+							request.paymentsSummaryRequest.from, request.paymentsSummaryRequest.to);
 					break;
 
 				case IpcMessageType::REQUEST_PURGE_PAYMENTS:
 					paymentService->purge();
-					ipcMessage->responseReady.post();
 					break;
 
 				default:
-					ipcMessage->responseReady.post();
 					break;
 			}
+
+			ipcConnection->complete(request);
 		} while (true);
 	}
 
@@ -81,8 +91,7 @@ namespace
 
 		getConnection();
 
-		ipcConnection =
-			std::make_unique<IpcConnection>(Config::coordinator ? std::optional{Config::workers} : std::nullopt);
+		ipcConnection = std::make_unique<IpcConnection>(Config::coordinator);
 
 		for (unsigned i = 0; i < Config::workers; ++i)
 			threads.emplace_back([] { handler(); });
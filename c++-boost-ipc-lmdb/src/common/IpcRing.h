@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <span>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace rinhaback
+{
+	// Bounded lock-free MPMC ring to be placed in shared memory. Each cell carries a sequence number telling whether
+	// it's free for the producer of a given position or published for its consumer, so producers and consumers
+	// only contend on their own position counters.
+	template <typename T, std::size_t CAPACITY>
+	class IpcRing final
+	{
+		static_assert(CAPACITY > 0 && (CAPACITY & (CAPACITY - 1)) == 0, "CAPACITY must be a power of two");
+		static_assert(std::atomic<uint64_t>::is_always_lock_free, "Shared memory atomics must be lock free");
+
+	private:
+		struct Cell final
+		{
+			std::atomic<uint64_t> sequence;
+			T data;
+		};
+
+	public:
+		IpcRing()
+		{
+			for (std::size_t i = 0; i < CAPACITY; ++i)
+				cells[i].sequence.store(i, std::memory_order_relaxed);
+		}
+
+		IpcRing(const IpcRing&) = delete;
+		IpcRing& operator=(const IpcRing&) = delete;
+
+	public:
+		bool tryPush(const T& item)
+		{
+			return tryPush(std::span<const T>(&item, 1)) == 1;
+		}
+
+		// Claims consecutive positions for as many items as there are free cells ahead and returns how many were
+		// pushed
+		std::size_t tryPush(std::span<const T> items)
+		{
+			auto pos = enqueuePos.load(std::memory_order_relaxed);
+			std::size_t count;
+
+			while (true)
+			{
+				count = 0;
+
+				while (count < items.size() &&
+					getCell(pos + count).sequence.load(std::memory_order_acquire) == pos + count)
+				{
+					++count;
+				}
+
+				if (count == 0)
+				{
+					const auto& cell = getCell(pos);
+
+					// Full, or another producer advanced the position in the meantime
+					if (static_cast<int64_t>(cell.sequence.load(std::memory_order_acquire) - pos) < 0)
+						return 0;
+
+					pos = enqueuePos.load(std::memory_order_relaxed);
+					continue;
+				}
+
+				if (enqueuePos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed))
+					break;
+			}
+
+			for (std::size_t i = 0; i < count; ++i)
+			{
+				auto& cell = getCell(pos + i);
+				cell.data = items[i];
+				cell.sequence.store(pos + i + 1, std::memory_order_release);
+			}
+
+			return count;
+		}
+
+		bool tryPop(T& item)
+		{
+			auto pos = dequeuePos.load(std::memory_order_relaxed);
+
+			while (true)
+			{
+				auto& cell = getCell(pos);
+				const auto diff = static_cast<int64_t>(cell.sequence.load(std::memory_order_acquire) - (pos + 1));
+
+				if (diff == 0)
+				{
+					if (dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+					{
+						item = cell.data;
+						cell.sequence.store(pos + CAPACITY, std::memory_order_release);
+						return true;
+					}
+				}
+				else if (diff < 0)
+					return false;
+				else
+					pos = dequeuePos.load(std::memory_order_relaxed);
+			}
+		}
+
+	private:
+		Cell& getCell(uint64_t pos)
+		{
+			return cells[pos & (CAPACITY - 1)];
+		}
+
+	private:
+		alignas(64) std::atomic<uint64_t> enqueuePos{0};
+		alignas(64) std::atomic<uint64_t> dequeuePos{0};
+		alignas(64) Cell cells[CAPACITY];
+	};
+}  // namespace rinhaback
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+namespace rinhaback
+{
+	// Counting semaphore to be placed in shared memory. Waiters spin on the count for an adaptive number of
+	// iterations before sleeping on a shared futex, and posters only make the wake syscall when someone sleeps.
+	class IpcSemaphore final
+	{
+	private:
+		static constexpr uint32_t MIN_SPINS = 16;
+		static constexpr uint32_t MAX_SPINS = 4096;
+
+	public:
+		IpcSemaphore() = default;
+
+		IpcSemaphore(const IpcSemaphore&) = delete;
+		IpcSemaphore& operator=(const IpcSemaphore&) = delete;
+
+	public:
+		void post(uint32_t n = 1)
+		{
+			count.fetch_add(n, std::memory_order_seq_cst);
+
+			// Pairs with the sleepers increment in wait: either the waiter sees the new count or this sees it
+			if (sleepers.load(std::memory_order_seq_cst) != 0)
+				futex(FUTEX_WAKE, std::min<uint32_t>(n, INT32_MAX));
+		}
+
+		void wait()
+		{
+			const auto spins = spinLimit.load(std::memory_order_relaxed);
+
+			for (uint32_t i = 0; i < spins; ++i)
+			{
+				if (tryWait())
+				{
+					spinLimit.store(std::min(spins * 2, MAX_SPINS), std::memory_order_relaxed);
+					return;
+				}
+
+				cpuRelax();
+			}
+
+			spinLimit.store(std::max(spins / 2, MIN_SPINS), std::memory_order_relaxed);
+
+			while (!tryWait())
+			{
+				sleepers.fetch_add(1, std::memory_order_seq_cst);
+
+				// The kernel only puts the thread to sleep if the count is still zero
+				if (count.load(std::memory_order_seq_cst) == 0)
+					futex(FUTEX_WAIT, 0);
+
+				sleepers.fetch_sub(1, std::memory_order_relaxed);
+			}
+		}
+
+		bool tryWait()
+		{
+			auto value = count.load(std::memory_order_relaxed);
+
+			while (value != 0)
+			{
+				if (count.compare_exchange_weak(value, value - 1, std::memory_order_acquire))
+					return true;
+			}
+
+			return false;
+		}
+
+	private:
+		// Not FUTEX_PRIVATE_FLAG, as the word is shared between processes
+		void futex(int op, uint32_t value)
+		{
+			syscall(SYS_futex, reinterpret_cast<uint32_t*>(&count), op, value, nullptr, nullptr, 0);
+		}
+
+		static void cpuRelax()
+		{
+#if defined(__x86_64__) || defined(__i386__)
+			__builtin_ia32_pause();
+#elif defined(__aarch64__)
+			asm volatile("yield");
+#endif
+		}
+
+	private:
+		static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t) && std::atomic<uint32_t>::is_always_lock_free,
+			"Futex word must be a plain 32-bit atomic");
+
+		alignas(64) std::atomic<uint32_t> count{0};
+		std::atomic<uint32_t> sleepers{0};
+		std::atomic<uint32_t> spinLimit{MIN_SPINS};
+	};
+}  // namespace rinhaback
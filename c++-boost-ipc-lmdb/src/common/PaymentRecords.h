@@ -0,0 +1,59 @@
+#pragma once
+
+#include "Types.h"
+#include <array>
+#include <bit>
+#include <optional>
+#include <cstdint>
+#include "lmdb.h"
+
+
+namespace rinhaback
+{
+	// Layout of the payments database, written by the API and also read by the proxy
+
+	struct __attribute__((packed)) PaymentKey final
+	{
+		std::int64_t dateTime;
+	};
+
+	struct __attribute__((packed)) PaymentData final
+	{
+		double amount;
+		CorrelationId correlationId;
+	};
+
+	// Indexed by the gateway, default and fallback
+	inline constexpr std::array<const char*, 2> PAYMENT_DBI_NAMES = {"default", "fallback"};
+
+	inline constexpr unsigned PAYMENT_DBI_FLAGS = MDB_DUPSORT | MDB_DUPFIXED |
+		(std::endian::native == std::endian::little ? (MDB_REVERSEKEY | MDB_REVERSEDUP) : 0);
+
+	// Adds the payments of the range to the response, returning MDB_NOTFOUND when the cursor reaches its end
+	inline int sumPayments(MDB_cursor* cursor, std::optional<std::int64_t> from, std::optional<std::int64_t> to,
+		PaymentsGatewaySummaryResponse& response)
+	{
+		PaymentKey initialKey{.dateTime = from.value_or(0)};
+
+		MDB_val mdbKey(sizeof(initialKey), &initialKey);
+		MDB_val mdbData;
+
+		int rc = mdb_cursor_get(cursor, &mdbKey, &mdbData, (from ? MDB_SET_RANGE : MDB_FIRST));
+
+		while (rc == 0)
+		{
+			const auto* key = static_cast<const PaymentKey*>(mdbKey.mv_data);
+			const auto* data = static_cast<const PaymentData*>(mdbData.mv_data);
+
+			if (to.has_value() && key->dateTime > to.value())
+				return MDB_NOTFOUND;
+
+			++response.totalRequests;
+			response.totalAmount += data->amount;
+
+			rc = mdb_cursor_get(cursor, &mdbKey, &mdbData, MDB_NEXT);
+		}
+
+		return rc;
+	}
+}  // namespace rinhaback
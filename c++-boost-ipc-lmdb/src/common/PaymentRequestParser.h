@@ -0,0 +1,153 @@
+#pragma once
+
+#include "./Types.h"
+#include <charconv>
+#include <string_view>
+#include <system_error>
+#include <cmath>
+
+
+namespace rinhaback
+{
+	// Parser specialized for the POST /payments body: {"correlationId": "<uuid>", "amount": <number>}.
+	// It reads directly into the caller's fields without allocating. Bodies it does not recognize (escapes, unknown or
+	// repeated fields, non-canonical numbers) are reported as FALLBACK so the caller can use a generic JSON parser.
+	class PaymentRequestParser final
+	{
+	public:
+		enum class Result
+		{
+			OK,
+			INVALID,
+			FALLBACK
+		};
+
+	public:
+		PaymentRequestParser() = delete;
+
+	public:
+		static Result parse(std::string_view json, CorrelationId& correlationId, double& amount)
+		{
+			const char* pos = json.data();
+			const char* const end = pos + json.size();
+			bool hasCorrelationId = false;
+			bool hasAmount = false;
+
+			if (!consume(pos, end, '{'))
+				return Result::FALLBACK;
+
+			do
+			{
+				if ((hasCorrelationId || hasAmount) && !consume(pos, end, ','))
+					return Result::FALLBACK;
+
+				if (!hasCorrelationId && consumeKey(pos, end, CORRELATION_ID_KEY))
+				{
+					if (const auto result = parseCorrelationId(pos, end, correlationId);
+						result != Result::OK)
+					{
+						return result;
+					}
+
+					hasCorrelationId = true;
+				}
+				else if (!hasAmount && consumeKey(pos, end, AMOUNT_KEY))
+				{
+					if (const auto result = parseAmount(pos, end, amount); result != Result::OK)
+						return result;
+
+					hasAmount = true;
+				}
+				else
+					return Result::FALLBACK;
+			} while (!hasCorrelationId || !hasAmount);
+
+			if (!consume(pos, end, '}'))
+				return Result::FALLBACK;
+
+			skipWhitespace(pos, end);
+
+			return pos == end ? Result::OK : Result::FALLBACK;
+		}
+
+	private:
+		static void skipWhitespace(const char*& pos, const char* end)
+		{
+			while (pos != end && (*pos == ' ' || *pos == '\n' || *pos == '\r' || *pos == '\t'))
+				++pos;
+		}
+
+		static bool consume(const char*& pos, const char* end, char c)
+		{
+			skipWhitespace(pos, end);
+
+			if (pos == end || *pos != c)
+				return false;
+
+			++pos;
+			return true;
+		}
+
+		static bool consumeKey(const char*& pos, const char* end, std::string_view key)
+		{
+			skipWhitespace(pos, end);
+
+			if (static_cast<std::size_t>(end - pos) < key.size() || std::string_view(pos, key.size()) != key)
+				return false;
+
+			const char* keyEnd = pos + key.size();
+
+			if (!consume(keyEnd, end, ':'))
+				return false;
+
+			pos = keyEnd;
+			skipWhitespace(pos, end);
+			return true;
+		}
+
+		static Result parseCorrelationId(const char*& pos, const char* end, CorrelationId& correlationId)
+		{
+			if (pos == end || *pos != '"')
+				return Result::FALLBACK;
+
+			++pos;
+
+			if (static_cast<std::size_t>(end - pos) <= correlationId.size() || pos[correlationId.size()] != '"')
+				return Result::FALLBACK;
+
+			// Any 36 characters are accepted, as by the generic parser. Escapes and control characters are left to
+			// it, as they change the length or make the JSON invalid.
+			for (std::size_t i = 0; i < correlationId.size(); ++i)
+			{
+				const char c = pos[i];
+
+				if (c == '\\' || c == '"' || static_cast<unsigned char>(c) < 0x20)
+					return Result::FALLBACK;
+
+				correlationId[i] = c;
+			}
+
+			pos += correlationId.size() + 1;
+			return Result::OK;
+		}
+
+		static Result parseAmount(const char*& pos, const char* end, double& amount)
+		{
+			if (pos == end || !(*pos == '-' || (*pos >= '0' && *pos <= '9')))
+				return Result::FALLBACK;
+
+			const auto [numberEnd, ec] = std::from_chars(pos, end, amount);
+
+			if (ec != std::errc())
+				return Result::FALLBACK;
+
+			pos = numberEnd;
+
+			return std::isfinite(amount) && amount > 0 ? Result::OK : Result::INVALID;
+		}
+
+	private:
+		static constexpr std::string_view CORRELATION_ID_KEY = R"("correlationId")";
+		static constexpr std::string_view AMOUNT_KEY = R"("amount")";
+	};
+}  // namespace rinhaback
@@ -1,15 +1,19 @@
 #pragma once
 
+#include "./IpcRing.h"
+#include "./IpcSemaphore.h"
 #include "./Types.h"
 #include <mutex>
 #include <optional>
 #include <print>
+#include <span>
+#include <thread>
+#include <cstddef>
 #include <cstdint>
 #include "boost/interprocess/mapped_region.hpp"
 #include "boost/interprocess/shared_memory_object.hpp"
 #include "boost/interprocess/sync/interprocess_condition.hpp"
 #include "boost/interprocess/sync/interprocess_mutex.hpp"
-#include "boost/interprocess/sync/interprocess_semaphore.hpp"
 
 
 namespace rinhaback
@@ -17,67 +21,98 @@ namespace rinhaback
 	enum class IpcMessageType : uint8_t
 	{
 		REQUEST_POST_PAYMENT,
+		REQUEST_POST_PAYMENTS_BATCH,
 		REQUEST_PAYMENTS_SUMMARY,
 		REQUEST_PURGE_PAYMENTS
 	};
 
-	struct IpcMessage
+	struct IpcPostPayment
 	{
-		IpcMessage() { }
+		CorrelationId correlationId;
+		double amount;
+	};
+
+	struct IpcRequest
+	{
+		static constexpr uint32_t NO_RESPONSE_SLOT = UINT32_MAX;
+		static constexpr uint32_t MAX_PAYMENTS_BATCH = 16;
 
-		boost::interprocess::interprocess_semaphore requestReady{0};
-		boost::interprocess::interprocess_semaphore responseReady{0};
+		IpcRequest() { }
 
 		IpcMessageType messageType;
+		uint32_t responseSlot = NO_RESPONSE_SLOT;
 
 		union
 		{
+			IpcPostPayment postPaymentRequest;
+
 			struct
 			{
-				CorrelationId correlationId;
-				double amount;
-			} postPaymentRequest;
+				uint32_t count;
+				IpcPostPayment payments[MAX_PAYMENTS_BATCH];
+			} postPaymentsBatchRequest;
 
 			struct
 			{
 				std::optional<DateTimeMillis> from;
 				std::optional<DateTimeMillis> to;
 			} paymentsSummaryRequest;
-
-			PaymentsSummaryResponse paymentsSummaryResponse;
 		};
 	};
 
+	struct IpcResponseSlot
+	{
+		PaymentsSummaryResponse paymentsSummaryResponse;
+	};
+
 	struct IpcHeader
 	{
+		static constexpr std::size_t REQUEST_RING_CAPACITY = 1024;
+		static constexpr std::size_t RESPONSE_SLOTS = 256;
+
+		IpcHeader()
+		{
+			for (uint32_t i = 0; i < RESPONSE_SLOTS; ++i)
+				freeResponseSlots.tryPush(i);
+		}
+
 		bool ready = false;
 		boost::interprocess::interprocess_mutex readyMutex;
 		boost::interprocess::interprocess_condition readyCondition;
-		IpcMessage items[];
+
+		IpcSemaphore requestsAvailable;
+		IpcRing<IpcRequest, REQUEST_RING_CAPACITY> requests;
+
+		IpcRing<uint32_t, RESPONSE_SLOTS> freeResponseSlots;
+		IpcResponseSlot responseSlots[RESPONSE_SLOTS];
+
+		// Holds the slots of completed requests, plus room for the proxy to stop its completion watcher
+		IpcSemaphore completionsAvailable;
+		IpcRing<uint32_t, RESPONSE_SLOTS * 2> completions;
 	};
 
+	// Requests from any proxy thread go through a single submission ring that any number of API handler threads,
+	// in any API process, consume. Requests that need a response carry a slot taken from a free list, so each
+	// thread may have many of them outstanding. Their slots are returned through the completion ring.
 	class IpcConnection
 	{
 	private:
 		static constexpr const char* SHARED_MEMORY_NAME = "rinhaback25-boost-lmdb-ipc-connection";
 
 	public:
-		explicit IpcConnection(std::optional<unsigned> workersCount)
+		explicit IpcConnection(bool create)
 		{
-			if (workersCount.has_value())
+			if (create)
 			{
 				boost::interprocess::shared_memory_object::remove(SHARED_MEMORY_NAME);
 				shm = boost::interprocess::shared_memory_object(
 					boost::interprocess::create_only, SHARED_MEMORY_NAME, boost::interprocess::read_write);
 
-				shm.truncate(sizeof(IpcHeader) + sizeof(IpcMessage) * workersCount.value());
+				shm.truncate(sizeof(IpcHeader));
 
 				region = boost::interprocess::mapped_region(shm, boost::interprocess::read_write);
 				header = new (region.get_address()) IpcHeader();
 
-				for (unsigned i = 0; i < workersCount.value(); ++i)
-					new (&header->items[i]) IpcMessage();
-
 				std::println("IPC connection initialized.");
 				std::fflush(stdout);
 
@@ -100,10 +135,92 @@ namespace rinhaback
 			}
 		}
 
+		IpcConnection(const IpcConnection&) = delete;
+		IpcConnection& operator=(const IpcConnection&) = delete;
+
 	public:
-		IpcHeader* header;
+		// Producer side
+
+		void submit(const IpcRequest& request)
+		{
+			submit(std::span<const IpcRequest>(&request, 1));
+		}
+
+		void submit(std::span<const IpcRequest> requests)
+		{
+			while (!requests.empty())
+			{
+				const auto count = header->requests.tryPush(requests);
+
+				if (count != 0)
+					header->requestsAvailable.post(static_cast<uint32_t>(count));
+				else
+					std::this_thread::yield();
+
+				requests = requests.subspan(count);
+			}
+		}
+
+		// Fails when all the slots are taken by requests still waiting for the API
+		bool tryAcquireResponseSlot(uint32_t& slot)
+		{
+			return header->freeResponseSlots.tryPop(slot);
+		}
+
+		void releaseResponseSlot(uint32_t slot)
+		{
+			header->freeResponseSlots.tryPush(slot);
+		}
+
+		IpcResponseSlot& getResponseSlot(uint32_t slot)
+		{
+			return header->responseSlots[slot];
+		}
+
+		uint32_t waitCompletion()
+		{
+			header->completionsAvailable.wait();
+
+			uint32_t slot;
+
+			while (!header->completions.tryPop(slot))
+				std::this_thread::yield();
+
+			return slot;
+		}
+
+		// Consumer side
+
+		IpcRequest receive()
+		{
+			header->requestsAvailable.wait();
+
+			// The semaphore is posted after the item is published, but an earlier position may still be being
+			// written by another producer
+			IpcRequest request;
+
+			while (!header->requests.tryPop(request))
+				std::this_thread::yield();
+
+			return request;
+		}
+
+		void complete(const IpcRequest& request)
+		{
+			if (request.responseSlot != IpcRequest::NO_RESPONSE_SLOT)
+				postCompletion(request.responseSlot);
+		}
+
+		void postCompletion(uint32_t slot)
+		{
+			while (!header->completions.tryPush(slot))
+				std::this_thread::yield();
+
+			header->completionsAvailable.post();
+		}
 
 	private:
+		IpcHeader* header;
 		boost::interprocess::shared_memory_object shm;
 		boost::interprocess::mapped_region region;
 	};
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <chrono>
 #include <string>
 #include <cstdlib>
 
@@ -23,5 +24,11 @@ namespace rinhaback::proxy
 		static inline const auto listenAddress = readEnv("LISTEN_ADDRESS", "0.0.0.0:9999");
 		static inline const auto backend0Address = readEnv("BACKEND_0_ADDRESS", "localhost:8001");
 		static inline const auto backend1Address = readEnv("BACKEND_1_ADDRESS", "localhost:8002");
+		static inline const auto paymentBatchSize =
+			static_cast<unsigned>(std::stoul(readEnv("PAYMENT_BATCH_SIZE", "16")));
+		static inline const auto paymentBatchWindow =
+			std::chrono::microseconds(std::stoul(readEnv("PAYMENT_BATCH_WINDOW_US", "1000")));
+		static inline const auto summaryFromDatabase = readEnv("SUMMARY_FROM_DATABASE", "false") == "true";
+		static inline const auto database = readEnv("DATABASE", "/data/database");
 	};
 }  // namespace rinhaback::proxy
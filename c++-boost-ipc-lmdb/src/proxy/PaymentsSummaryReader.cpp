@@ -0,0 +1,108 @@
+#include "./PaymentsSummaryReader.h"
+#include "./Config.h"
+#include <format>
+#include <print>
+#include <stdexcept>
+#include <string>
+
+
+namespace rinhaback::proxy
+{
+	static void checkMdbError(int rc)
+	{
+		if (rc != 0)
+		{
+			const auto msg = std::format("MDB error: {}", rc);
+			std::println(stderr, "{}", msg);
+			std::fflush(stderr);
+			throw std::runtime_error(msg);
+		}
+	}
+
+	PaymentsSummaryReader::PaymentsSummaryReader()
+	{
+		// The map size is taken from the database, as set by the API
+		checkMdbError(mdb_env_create(&env));
+		checkMdbError(mdb_env_set_maxdbs(env, dbis.size()));
+		checkMdbError(mdb_env_open(env, Config::database.c_str(), MDB_RDONLY | MDB_NOTLS, 0664));
+
+		MDB_txn* txn;
+		checkMdbError(mdb_txn_begin(env, nullptr, MDB_RDONLY, &txn));
+
+		for (std::size_t i = 0; i < dbis.size(); ++i)
+			checkMdbError(mdb_dbi_open(txn, PAYMENT_DBI_NAMES[i], PAYMENT_DBI_FLAGS, &dbis[i]));
+
+		// Handles opened in a transaction are only kept after it's committed
+		checkMdbError(mdb_txn_commit(txn));
+
+		std::println("Database opened read-only.");
+		std::fflush(stdout);
+	}
+
+	PaymentsSummaryReader::~PaymentsSummaryReader()
+	{
+		for (auto dbi : dbis)
+		{
+			if (dbi)
+				mdb_dbi_close(env, dbi);
+		}
+
+		mdb_env_close(env);
+	}
+
+	PaymentsSummaryResponse PaymentsSummaryReader::getPaymentsSummary(
+		std::optional<DateTimeMillis> from, std::optional<DateTimeMillis> to)
+	{
+		const std::optional<std::int64_t> fromInt =
+			from.has_value() ? std::make_optional(from->time_since_epoch().count()) : std::nullopt;
+		const std::optional<std::int64_t> toInt =
+			to.has_value() ? std::make_optional(to->time_since_epoch().count()) : std::nullopt;
+
+		MDB_txn* txn;
+		int rc;
+
+		// The API grew the map. Summaries run on a single thread, so there is no other transaction open here.
+		while ((rc = mdb_txn_begin(env, nullptr, MDB_RDONLY, &txn)) == MDB_MAP_RESIZED)
+			checkMdbError(mdb_env_set_mapsize(env, 0));
+
+		checkMdbError(rc);
+
+		try
+		{
+			PaymentsSummaryResponse response{
+				.defaultGateway = getGatewaySummary(txn, dbis[0], fromInt, toInt),
+				.fallbackGateway = getGatewaySummary(txn, dbis[1], fromInt, toInt),
+			};
+
+			mdb_txn_abort(txn);
+
+			return response;
+		}
+		catch (...)
+		{
+			mdb_txn_abort(txn);
+			throw;
+		}
+	}
+
+	PaymentsGatewaySummaryResponse PaymentsSummaryReader::getGatewaySummary(
+		MDB_txn* txn, MDB_dbi dbi, std::optional<std::int64_t> from, std::optional<std::int64_t> to)
+	{
+		PaymentsGatewaySummaryResponse response = {
+			.totalRequests = 0,
+			.totalAmount = 0.0,
+		};
+
+		MDB_cursor* cursor;
+		checkMdbError(mdb_cursor_open(txn, dbi, &cursor));
+
+		const int rc = sumPayments(cursor, from, to, response);
+
+		mdb_cursor_close(cursor);
+
+		if (rc != MDB_NOTFOUND)
+			checkMdbError(rc);
+
+		return response;
+	}
+}  // namespace rinhaback::proxy
@@ -0,0 +1,36 @@
+#pragma once
+
+#include "../common/PaymentRecords.h"
+#include "../common/Types.h"
+#include <array>
+#include <optional>
+#include <cstdint>
+#include "lmdb.h"
+
+
+namespace rinhaback::proxy
+{
+	// Read-only view of the API database, used to answer summaries in the proxy without an IPC round trip.
+	// It must be opened after the API coordinator has initialized the database.
+	class PaymentsSummaryReader final
+	{
+	public:
+		explicit PaymentsSummaryReader();
+		~PaymentsSummaryReader();
+
+		PaymentsSummaryReader(const PaymentsSummaryReader&) = delete;
+		PaymentsSummaryReader& operator=(const PaymentsSummaryReader&) = delete;
+
+	public:
+		PaymentsSummaryResponse getPaymentsSummary(
+			std::optional<DateTimeMillis> from, std::optional<DateTimeMillis> to);
+
+	private:
+		PaymentsGatewaySummaryResponse getGatewaySummary(
+			MDB_txn* txn, MDB_dbi dbi, std::optional<std::int64_t> from, std::optional<std::int64_t> to);
+
+	private:
+		MDB_env* env = nullptr;
+		std::array<MDB_dbi, 2> dbis{};
+	};
+}  // namespace rinhaback::proxy
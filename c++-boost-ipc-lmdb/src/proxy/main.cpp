@@ -1,16 +1,20 @@
 #include "mimalloc-new-delete.h"
 #include "./Config.h"
+#include "./PaymentsSummaryReader.h"
+#include "../common/PaymentRequestParser.h"
 #include "../common/Protocol.h"
 #include "../common/Util.h"
+#include <algorithm>
 #include <array>
-#include <atomic>
 #include <chrono>
 #include <memory>
+#include <mutex>
 #include <print>
 #include <span>
 #include <string>
 #include <thread>
 #include <vector>
+#include <csignal>
 #include "boost/asio.hpp"
 #include "boost/beast.hpp"
 #include "boost/json.hpp"
@@ -29,8 +33,133 @@ namespace
 	constexpr std::chrono::seconds connectionTimeout{30};
 	std::unique_ptr<asio::io_context> ioc;
 	std::unique_ptr<IpcConnection> ipcConnection;
-	std::atomic_uint backendIds;
-	thread_local std::optional<unsigned> backendIdOpt;
+	std::unique_ptr<PaymentsSummaryReader> summaryReader;
+	std::unique_ptr<asio::thread_pool> summaryPool;
+	std::array<asio::any_completion_handler<void()>, IpcHeader::RESPONSE_SLOTS> pendingResponses;
+
+	// Submits a request that needs a response, in the slot the caller acquired. It completes in the caller's
+	// executor once the response is in its slot, and the caller must then release the slot.
+	template <typename CompletionToken>
+	auto asyncRequest(IpcRequest& message, CompletionToken&& token)
+	{
+		return asio::async_initiate<CompletionToken, void()>(
+			[&message](auto handler)
+			{
+				pendingResponses[message.responseSlot] = std::move(handler);
+				ipcConnection->submit(message);
+			},
+			token);
+	}
+
+	// Coalesces accepted payments into batch requests. A batch is submitted when it's full or when the window
+	// started by its first payment expires. Submitting may wait for room in the ring, so it's done after the batch
+	// is taken out and the mutex released.
+	class PaymentBatcher final
+	{
+	public:
+		explicit PaymentBatcher(asio::io_context& ioc)
+			: timer(ioc),
+			  maxSize(std::clamp(Config::paymentBatchSize, 1u, IpcRequest::MAX_PAYMENTS_BATCH))
+		{
+			request.messageType = IpcMessageType::REQUEST_POST_PAYMENTS_BATCH;
+			request.postPaymentsBatchRequest.count = 0;
+		}
+
+		PaymentBatcher(const PaymentBatcher&) = delete;
+		PaymentBatcher& operator=(const PaymentBatcher&) = delete;
+
+	public:
+		void add(const IpcPostPayment& payment)
+		{
+			IpcRequest fullBatch;
+
+			{  // scope
+				std::unique_lock lock(mutex);
+
+				auto& batch = request.postPaymentsBatchRequest;
+				batch.payments[batch.count++] = payment;
+
+				if (batch.count == 1)
+				{
+					timer.expires_after(Config::paymentBatchWindow);
+					timer.async_wait(
+						[this](const boost::system::error_code& ec)
+						{
+							if (ec)
+								return;
+
+							IpcRequest expiredBatch;
+
+							if (takeBatch(expiredBatch))
+								ipcConnection->submit(expiredBatch);
+						});
+				}
+
+				if (batch.count != maxSize)
+					return;
+
+				timer.cancel();
+				takeBatchLocked(fullBatch);
+			}
+
+			ipcConnection->submit(fullBatch);
+		}
+
+		// Submits the payments still waiting for their window, after the io_context has stopped
+		void stop()
+		{
+			IpcRequest pendingBatch;
+
+			if (!takeBatch(pendingBatch))
+				return;
+
+			const auto count = pendingBatch.postPaymentsBatchRequest.count;
+			ipcConnection->submit(pendingBatch);
+
+			std::println("Submitted {} pending batched payment(s) on stop.", count);
+			std::fflush(stdout);
+		}
+
+	private:
+		// A timer that already expired may take a newer batch early
+		bool takeBatch(IpcRequest& batchRequest)
+		{
+			std::unique_lock lock(mutex);
+			return takeBatchLocked(batchRequest);
+		}
+
+		bool takeBatchLocked(IpcRequest& batchRequest)
+		{
+			if (request.postPaymentsBatchRequest.count == 0)
+				return false;
+
+			batchRequest = request;
+			request.postPaymentsBatchRequest.count = 0;
+			return true;
+		}
+
+	private:
+		std::mutex mutex;
+		asio::steady_timer timer;
+		const unsigned maxSize;
+		IpcRequest request;
+	};
+
+	std::unique_ptr<PaymentBatcher> paymentBatcher;
+
+	// Delivers IPC completions into the io_context, resuming the coroutines waiting on them
+	void watchCompletions()
+	{
+		while (true)
+		{
+			const auto slot = ipcConnection->waitCompletion();
+
+			if (slot == IpcRequest::NO_RESPONSE_SLOT)
+				break;
+
+			asio::post(ioc->get_executor(), std::move(pendingResponses[slot]));
+		}
+	}
 
 	class Session final : public std::enable_shared_from_this<Session>
 	{
@@ -63,12 +192,7 @@ namespace
 	private:
 		asio::awaitable<void> processRequest()
 		{
-			if (!backendIdOpt.has_value())
-				backendIdOpt = backendIds++;
-
-			const auto backendId = backendIdOpt.value();
-
-			auto& message = ipcConnection->header->items[backendId];
+			IpcRequest message;
 
 			response.result(http::status::not_found);
 
@@ -91,11 +215,36 @@ namespace
 						if (const auto toParam = urlParams.find("to"); toParam != urlParams.end())
 							message.paymentsSummaryRequest.to = parseDateTime((*toParam).value);
 
-						message.requestReady.post();
-						message.responseReady.wait();
+						PaymentsSummaryResponse summary;
 
-						const auto& defaultGateway = message.paymentsSummaryResponse.defaultGateway;
-						const auto& fallbackGateway = message.paymentsSummaryResponse.fallbackGateway;
+						if (summaryReader)
+						{
+							// Scan the database here, but off the IO threads
+							co_await asio::co_spawn(
+								*summaryPool,
+								[&]() -> asio::awaitable<void>
+								{
+									summary = summaryReader->getPaymentsSummary(
+										message.paymentsSummaryRequest.from, message.paymentsSummaryRequest.to);
+									co_return;
+								},
+								asio::use_awaitable);
+						}
+						else if (!ipcConnection->tryAcquireResponseSlot(message.responseSlot))
+						{
+							response.result(http::status::service_unavailable);
+							break;
+						}
+						else
+						{
+							co_await asyncRequest(message, asio::use_awaitable);
+
+							summary = ipcConnection->getResponseSlot(message.responseSlot).paymentsSummaryResponse;
+							ipcConnection->releaseResponseSlot(message.responseSlot);
+						}
+
+						const auto& defaultGateway = summary.defaultGateway;
+						const auto& fallbackGateway = summary.fallbackGateway;
 
 						response.result(http::status::ok);
 						response.set(http::field::content_type, "application/json");
@@ -113,37 +262,61 @@ namespace
 					{
 						message.postPaymentRequest = {};
 
-						auto inJsonObj = boost::json::parse(request.body()).as_object();
-						const auto& correlationIdJson = inJsonObj["correlationId"];
-						const auto amountJson = inJsonObj["amount"];
+						auto& postPaymentRequest = message.postPaymentRequest;
+						auto parseResult = PaymentRequestParser::parse(
+							request.body(), postPaymentRequest.correlationId, postPaymentRequest.amount);
 
-						if (correlationIdJson.is_string() && amountJson.is_number())
+						if (parseResult == PaymentRequestParser::Result::FALLBACK)
 						{
-							const auto& correlationId = correlationIdJson.as_string();
-							message.postPaymentRequest.amount = amountJson.to_number<double>();
+							parseResult = PaymentRequestParser::Result::INVALID;
 
-							if (correlationId.size() == std::tuple_size<CorrelationId>() &&
-								message.postPaymentRequest.amount > 0)
-							{
-								std::copy_n(correlationId.data(), message.postPaymentRequest.correlationId.size(),
-									message.postPaymentRequest.correlationId.begin());
+							auto inJsonObj = boost::json::parse(request.body()).as_object();
+							const auto& correlationIdJson = inJsonObj["correlationId"];
+							const auto amountJson = inJsonObj["amount"];
 
-								message.messageType = IpcMessageType::REQUEST_POST_PAYMENT;
+							if (correlationIdJson.is_string() && amountJson.is_number())
+							{
+								const auto& correlationId = correlationIdJson.as_string();
+								postPaymentRequest.amount = amountJson.to_number<double>();
 
-								message.requestReady.post();
+								if (correlationId.size() == std::tuple_size<CorrelationId>() &&
+									postPaymentRequest.amount > 0)
+								{
+									std::copy_n(correlationId.data(), postPaymentRequest.correlationId.size(),
+										postPaymentRequest.correlationId.begin());
 
-								response.result(http::status::ok);
+									parseResult = PaymentRequestParser::Result::OK;
+								}
 							}
+						}
+
+						if (parseResult == PaymentRequestParser::Result::OK)
+						{
+							if (paymentBatcher)
+								paymentBatcher->add(message.postPaymentRequest);
 							else
-								response.result(http::status::bad_request);
+							{
+								message.messageType = IpcMessageType::REQUEST_POST_PAYMENT;
+								ipcConnection->submit(message);
+							}
+
+							response.result(http::status::ok);
 						}
+						else
+							response.result(http::status::bad_request);
 					}
 					else if (request.target() == "/purge-payments")
 					{
 						message.messageType = IpcMessageType::REQUEST_PURGE_PAYMENTS;
 
-						message.requestReady.post();
-						message.responseReady.wait();
+						if (!ipcConnection->tryAcquireResponseSlot(message.responseSlot))
+						{
+							response.result(http::status::service_unavailable);
+							break;
+						}
+
+						co_await asyncRequest(message, asio::use_awaitable);
+						ipcConnection->releaseResponseSlot(message.responseSlot);
 
 						response.result(http::status::ok);
 					}
@@ -153,7 +326,10 @@ namespace
 					break;
 			}
 
-			response.result(http::status::ok);
+			// Only requests that couldn't be handed to the API, as all the response slots were taken, report it
+			if (response.result() != http::status::service_unavailable)
+				response.result(http::status::ok);
+
 			response.version(request.version());
 			response.keep_alive(response.result() == http::status::ok);
 			response.prepare_payload();
@@ -233,10 +409,20 @@ namespace
 
 	void run()
 	{
-		ipcConnection = std::make_unique<IpcConnection>(std::nullopt);
+		ipcConnection = std::make_unique<IpcConnection>(false);
+
+		// The API coordinator initializes the database before the IPC connection
+		if (Config::summaryFromDatabase)
+		{
+			summaryReader = std::make_unique<PaymentsSummaryReader>();
+			summaryPool = std::make_unique<asio::thread_pool>(1);
+		}
 
 		ioc = std::make_unique<asio::io_context>(Config::workers);
 
+		if (Config::paymentBatchSize > 1)
+			paymentBatcher = std::make_unique<PaymentBatcher>(*ioc);
+
 		const auto [ip, port] = parseHostPort(Config::listenAddress, 8080);
 		const auto endpoint = tcp::endpoint{asio::ip::make_address(ip), port};
 
@@ -251,9 +437,20 @@ namespace
 			},
 			asio::detached);
 
+		// Stops the io_context, so payments waiting in a batch are still submitted
+		asio::signal_set signals(*ioc, SIGINT, SIGTERM);
+		signals.async_wait(
+			[](const boost::system::error_code& ec, int)
+			{
+				if (!ec)
+					ioc->stop();
+			});
+
 		std::println("Server listening on {}", Config::listenAddress);
 		std::fflush(stdout);
 
+		std::jthread completionWatcher(watchCompletions);
+
 		std::vector<std::jthread> threads;
 		threads.reserve(Config::workers - 1);
 
@@ -276,6 +473,14 @@ namespace
 
 		ioc->run();
 
+		threads.clear();
+
+		if (paymentBatcher)
+			paymentBatcher->stop();
+
+		ipcConnection->postCompletion(IpcRequest::NO_RESPONSE_SLOT);
+		completionWatcher.join();
+
 		std::println("Proxy stopped");
 		std::fflush(stdout);
 	}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <cstddef>
 #include <cstdlib>
 
 
@@ -20,11 +21,30 @@ namespace rinhaback::api
 
 	public:
 		static inline const auto ioWorkers = static_cast<unsigned>(std::stoul(readEnv("IO_WORKERS", "8")));
+		static inline const auto ioContextPerThread = readEnv("IO_CONTEXT_PER_THREAD", "false") == "true";
+		static inline const auto ioPinThreads = readEnv("IO_PIN_THREADS", "false") == "true";
 		static inline const auto handlerWorkers = static_cast<unsigned>(std::stoul(readEnv("HANDLER_WORKERS", "8")));
+		static inline const auto summaryParallelism =
+			static_cast<unsigned>(std::stoul(readEnv("SUMMARY_PARALLELISM", "1")));
+		static inline const auto summaryPartitionRows =
+			static_cast<unsigned>(std::stoul(readEnv("SUMMARY_PARTITION_ROWS", "20000")));
+		static inline const auto summaryCacheSize =
+			static_cast<unsigned>(std::stoul(readEnv("SUMMARY_CACHE_SIZE", "0")));
+		static inline const auto summaryTotals = readEnv("SUMMARY_TOTALS", "false") == "true";
+		static inline const auto summaryTotalsHorizon =
+			static_cast<unsigned>(std::stoul(readEnv("SUMMARY_TOTALS_HORIZON", "3600")));
 		static inline const auto database = readEnv("DATABASE", "/data/database");
-		static inline const auto databaseSize = static_cast<unsigned>(std::stoul(readEnv("DATABASE_SIZE", "10485760")));
+		static inline const auto databaseSize = static_cast<unsigned>(std::stoul(readEnv("DATABASE_SIZE", "0")));
+		static inline const auto expectedPaymentRate =
+			static_cast<unsigned>(std::stoul(readEnv("EXPECTED_PAYMENT_RATE", "300")));
+		static inline const auto perInstanceDatabase = readEnv("PER_INSTANCE_DATABASE", "false") == "true";
+		static inline const auto ledgerStorage = readEnv("STORAGE_ENGINE", "lmdb") == "ledger";
+		static inline const auto ledgerCapacity =
+			static_cast<std::size_t>(std::stoul(readEnv("LEDGER_CAPACITY", "262144")));
 		static inline const auto coordinator = readEnv("COORDINATOR", "false") == "true";
+		static inline const auto instanceId = static_cast<unsigned>(std::stoul(readEnv("INSTANCE_ID", "0")));
 		static inline const auto listenAddress = readEnv("LISTEN_ADDRESS", "0.0.0.0:8080");
+		static inline const auto listenUnixPath = readEnv("LISTEN_UNIX_PATH", "");
 		static inline const auto processorDefaultAddress =
 			readEnv("PROCESSOR_DEFAULT_ADDRESS", "payment-processor-default:8080");
 		static inline const auto processorFallbackAddress =
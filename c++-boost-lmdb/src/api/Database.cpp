@@ -1,10 +1,24 @@
 #include "./Database.h"
 #include "./Config.h"
 #include "./Util.h"
+#include <algorithm>
+#include <atomic>
 #include <bit>
+#include <exception>
 #include <filesystem>
+#include <format>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <print>
+#include <string>
+#include <string_view>
 #include <thread>
 #include <cstring>
+#include "boost/interprocess/mapped_region.hpp"
+#include "boost/interprocess/shared_memory_object.hpp"
 #include "boost/interprocess/sync/named_semaphore.hpp"
 
 namespace stdfs = std::filesystem;
@@ -16,14 +30,110 @@ namespace rinhaback::api
 	static constexpr const char* SHARED_COORDINATOR_SEMAPHORE_NAME = "rinhaback25-boost-lmdb-Coordinator";
 	static boostipc::named_semaphore ready{boostipc::open_or_create, SHARED_COORDINATOR_SEMAPHORE_NAME, 0};
 
+	static constexpr std::string_view INSTANCE_DIRECTORY_PREFIX = "instance-";
+	static constexpr int ENV_FLAGS = MDB_WRITEMAP | MDB_NOMETASYNC | MDB_NOSYNC | MDB_NOTLS | MDB_NOMEMINIT;
+	static constexpr int DBI_FLAGS = MDB_DUPSORT | MDB_DUPFIXED |
+		(std::endian::native == std::endian::little ? (MDB_REVERSEKEY | MDB_REVERSEDUP) : 0);
+
+	static const auto instanceDirectory = std::format("{}{}", INSTANCE_DIRECTORY_PREFIX, Config::instanceId);
+
+	static constexpr const char* SHARED_EPOCH_NAME = "rinhaback25-boost-lmdb-Epoch";
+
+	// Number of purges done by all instances, whose parity is the active generation. Any value is fine on startup,
+	// as both generations are empty then.
+	static std::atomic_uint64_t& getEpoch()
+	{
+		static boostipc::shared_memory_object shm{boostipc::open_or_create, SHARED_EPOCH_NAME, boostipc::read_write};
+		static boostipc::mapped_region region = [&]
+		{
+			shm.truncate(sizeof(std::atomic_uint64_t));
+			return boostipc::mapped_region(shm, boostipc::read_write);
+		}();
+
+		return *static_cast<std::atomic_uint64_t*>(region.get_address());
+	}
+
+	// The first generation keeps the original names
+	static std::string getDbiName(unsigned generation, PaymentGateway gateway)
+	{
+		const auto name = gateway == PaymentGateway::DEFAULT ? "default" : "fallback";
+		return generation == 0 ? name : std::format("{}-{}", name, generation);
+	}
+
+	unsigned getActiveGeneration()
+	{
+		return static_cast<unsigned>(getEpoch().load(std::memory_order_acquire) % DATABASE_GENERATIONS);
+	}
+
+	unsigned switchActiveGeneration()
+	{
+		return static_cast<unsigned>((getEpoch().fetch_add(1, std::memory_order_acq_rel) + 1) % DATABASE_GENERATIONS);
+	}
+
+	static constexpr std::size_t MAP_SIZE_ALIGNMENT = 1024 * 1024;
+
+	// The initial map holds the payments expected in this time
+	static constexpr std::size_t INITIAL_MAP_SECONDS = 120;
+
+	// Stored size of a payment, including its share of the B-tree pages
+	static constexpr std::size_t PAYMENT_MAP_BYTES = 64;
+
+	// Memory limit of the container, from cgroup v2 or v1
+	static std::optional<std::size_t> getMemoryLimit()
+	{
+		for (const auto path : {"/sys/fs/cgroup/memory.max", "/sys/fs/cgroup/memory/memory.limit_in_bytes"})
+		{
+			std::ifstream file(path);
+			std::string value;
+
+			if (file >> value && value != "max")
+				return static_cast<std::size_t>(std::stoull(value));
+		}
+
+		return std::nullopt;
+	}
+
+	// DATABASE_SIZE when set, or room for the payments expected at EXPECTED_PAYMENT_RATE. With MDB_WRITEMAP the used
+	// pages of the map are charged to the container memory, so it's also limited to a quarter of it. The map grows
+	// when it becomes full.
+	static std::size_t getInitialMapSize()
+	{
+		if (Config::databaseSize != 0)
+			return Config::databaseSize;
+
+		auto size = std::size_t{Config::expectedPaymentRate} * INITIAL_MAP_SECONDS * PAYMENT_MAP_BYTES;
+
+		if (const auto memoryLimit = getMemoryLimit())
+			size = std::min(size, *memoryLimit / 4);
+
+		return std::max((size + MAP_SIZE_ALIGNMENT - 1) / MAP_SIZE_ALIGNMENT * MAP_SIZE_ALIGNMENT, MAP_SIZE_ALIGNMENT);
+	}
+
+	static std::size_t getMapSize(MDB_env* env)
+	{
+		MDB_envinfo info;
+		checkMdbError(mdb_env_info(env, &info));
+		return info.me_mapsize;
+	}
+
 	Connection::Connection()
 	{
+		const auto path = Config::perInstanceDatabase ? stdfs::path(Config::database) / instanceDirectory
+													  : stdfs::path(Config::database);
+
 		if (Config::coordinator)
 		{
 			if (stdfs::exists(Config::database))
 			{
 				stdfs::remove(stdfs::path(Config::database).append("data.mdb"));
 				stdfs::remove(stdfs::path(Config::database).append("lock.mdb"));
+
+				// Databases of the instances of a previous run
+				for (const auto& entry : stdfs::directory_iterator(Config::database))
+				{
+					if (entry.is_directory() && entry.path().filename().string().starts_with(INSTANCE_DIRECTORY_PREFIX))
+						stdfs::remove_all(entry.path());
+				}
 			}
 			else
 				stdfs::create_directories(Config::database);
@@ -36,25 +146,34 @@ namespace rinhaback::api
 			std::fflush(stdout);
 		}
 
-		const int endiannessFlags = std::endian::native == std::endian::little ? (MDB_REVERSEKEY | MDB_REVERSEDUP) : 0;
+		if (Config::perInstanceDatabase)
+			stdfs::create_directories(path);
+
+		const bool create = Config::coordinator || Config::perInstanceDatabase;
 
 		checkMdbError(mdb_env_create(&env));
-		checkMdbError(mdb_env_set_mapsize(env, Config::databaseSize));
-		checkMdbError(mdb_env_set_maxdbs(env, std::to_underlying(PaymentGateway::SIZE)));
-		checkMdbError(mdb_env_open(env, Config::database.c_str(),
-			MDB_WRITEMAP | MDB_NOMETASYNC | MDB_NOSYNC | MDB_NOTLS | MDB_NOMEMINIT |
-				(Config::coordinator ? MDB_CREATE : 0),
-			0664));
 
-		Transaction transaction(*this, 0);
+		// Others take the current size of the existing database
+		if (create)
+			checkMdbError(mdb_env_set_mapsize(env, getInitialMapSize()));
 
-		checkMdbError(
-			mdb_dbi_open(transaction.txn, "default", MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED | endiannessFlags,
-				&dbis[std::to_underlying(PaymentGateway::DEFAULT)]));
+		checkMdbError(mdb_env_set_maxdbs(env, DATABASE_GENERATIONS * std::to_underlying(PaymentGateway::SIZE)));
+		checkMdbError(mdb_env_open(env, path.c_str(), ENV_FLAGS | (create ? MDB_CREATE : 0), 0664));
 
-		checkMdbError(
-			mdb_dbi_open(transaction.txn, "fallback", MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED | endiannessFlags,
-				&dbis[std::to_underlying(PaymentGateway::FALLBACK)]));
+		mapSize = getMapSize(env);
+
+		{  // scope
+			Transaction transaction(*this, 0);
+
+			for (unsigned generation = 0; generation < DATABASE_GENERATIONS; ++generation)
+			{
+				for (const auto gateway : {PaymentGateway::DEFAULT, PaymentGateway::FALLBACK})
+				{
+					checkMdbError(mdb_dbi_open(transaction.txn, getDbiName(generation, gateway).c_str(),
+						MDB_CREATE | DBI_FLAGS, &dbis[generation][std::to_underlying(gateway)]));
+				}
+			}
+		}
 
 		if (Config::coordinator)
 		{
@@ -65,12 +184,124 @@ namespace rinhaback::api
 		}
 	}
 
+	Connection::Connection(const std::string& path)
+	{
+		checkMdbError(mdb_env_create(&env));
+
+		try
+		{
+			checkMdbError(
+				mdb_env_set_maxdbs(env, DATABASE_GENERATIONS * std::to_underlying(PaymentGateway::SIZE)));
+			checkMdbError(mdb_env_open(env, path.c_str(), ENV_FLAGS, 0664));
+
+			mapSize = getMapSize(env);
+
+			// The handles must be opened by a committed transaction to outlive it, and as they already exist a
+			// read-only one doesn't wait for the writer of the other instance
+			MDB_txn* txn;
+			checkMdbError(mdb_txn_begin(env, nullptr, MDB_RDONLY, &txn));
+
+			int rc = 0;
+
+			for (unsigned generation = 0; generation < DATABASE_GENERATIONS && rc == 0; ++generation)
+			{
+				for (const auto gateway : {PaymentGateway::DEFAULT, PaymentGateway::FALLBACK})
+				{
+					if (rc == 0)
+					{
+						rc = mdb_dbi_open(txn, getDbiName(generation, gateway).c_str(), DBI_FLAGS,
+							&dbis[generation][std::to_underlying(gateway)]);
+					}
+				}
+			}
+
+			if (rc == 0)
+				rc = mdb_txn_commit(txn);
+			else
+				mdb_txn_abort(txn);
+
+			checkMdbError(rc);
+		}
+		catch (...)
+		{
+			mdb_env_close(env);
+			throw;
+		}
+	}
+
+	std::vector<Connection*> getInstanceConnections()
+	{
+		if (!Config::perInstanceDatabase)
+			return {&getConnection()};
+
+		static std::mutex mutex;
+		static std::map<std::string, std::unique_ptr<Connection>> otherConnections;
+
+		std::vector<Connection*> connections{&getConnection()};
+		std::unique_lock lock(mutex);
+
+		for (const auto& entry : stdfs::directory_iterator(Config::database))
+		{
+			const auto name = entry.path().filename().string();
+
+			if (!entry.is_directory() || !name.starts_with(INSTANCE_DIRECTORY_PREFIX) || name == instanceDirectory ||
+				otherConnections.contains(name) || !stdfs::exists(entry.path() / "data.mdb"))
+			{
+				continue;
+			}
+
+			try
+			{
+				otherConnections.emplace(name, std::make_unique<Connection>(entry.path().string()));
+			}
+			catch (const std::exception&)
+			{
+				// Not initialized by its instance yet
+			}
+		}
+
+		for (const auto& [name, connection] : otherConnections)
+			connections.push_back(connection.get());
+
+		return connections;
+	}
+
+	void Connection::growMap(std::size_t fullMapSize)
+	{
+		std::unique_lock lock(mapMutex);
+
+		if (mapSize != fullMapSize)
+			return;
+
+		// Another process may have grown it already
+		checkMdbError(mdb_env_set_mapsize(env, 0));
+
+		if (getMapSize(env) <= fullMapSize)
+			checkMdbError(mdb_env_set_mapsize(env, fullMapSize * 2));
+
+		mapSize = getMapSize(env);
+
+		std::println("Database map grown to {} bytes.", mapSize);
+		std::fflush(stdout);
+	}
+
+	void Connection::adoptMapSize()
+	{
+		std::unique_lock lock(mapMutex);
+
+		checkMdbError(mdb_env_set_mapsize(env, 0));
+		mapSize = getMapSize(env);
+	}
+
 	Connection::~Connection()
 	{
-		for (auto dbi : dbis)
+		for (const auto& generationDbis : dbis)
 		{
-			if (dbi)
-				mdb_dbi_close(env, dbi);
+			for (const auto dbi : generationDbis)
+			{
+				if (dbi)
+					mdb_dbi_close(env, dbi);
+			}
 		}
 
 		mdb_env_close(env);
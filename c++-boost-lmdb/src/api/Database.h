@@ -2,8 +2,13 @@
 
 #include <array>
 #include <format>
+#include <map>
 #include <print>
+#include <shared_mutex>
+#include <string>
 #include <utility>
+#include <vector>
+#include <cstddef>
 #include <cstdint>
 #include "lmdb.h"
 
@@ -23,6 +28,16 @@ namespace rinhaback::api
 
 	using CorrelationId = std::array<char, 36>;
 
+	// Each gateway has a database per generation. Purges make the other generation active and empty the previous
+	// one in the background.
+	static constexpr unsigned DATABASE_GENERATIONS = 2;
+
+	// Generation used by all instances, to be read inside a transaction so it's consistent with a purge switching it
+	unsigned getActiveGeneration();
+
+	// Must be called inside the write transaction that emptied the databases of the next generation
+	unsigned switchActiveGeneration();
+
 	inline void checkMdbError(int rc
 #ifndef NDEBUG
 		,
@@ -47,15 +62,32 @@ namespace rinhaback::api
 	class Connection final
 	{
 	public:
+		// Creates the database of this instance
 		explicit Connection();
+
+		// Opens the existing database of another instance
+		explicit Connection(const std::string& path);
+
 		~Connection();
 
 		Connection(const Connection&) = delete;
 		Connection& operator=(const Connection&) = delete;
 
+	public:
+		// Grows the map after a write failed with MDB_MAP_FULL, unless it was already grown since that write began
+		void growMap(std::size_t fullMapSize);
+
+		// Adopts the map size set by another process, after MDB_MAP_RESIZED
+		void adoptMapSize();
+
 	public:
 		MDB_env* env;
-		std::array<MDB_dbi, std::to_underlying(PaymentGateway::SIZE)> dbis;
+		std::array<std::array<MDB_dbi, std::to_underlying(PaymentGateway::SIZE)>, DATABASE_GENERATIONS> dbis;
+
+		// Held shared by the transactions and exclusively to change the map size, which LMDB only allows while the
+		// process has no active transaction
+		std::shared_mutex mapMutex;
+		std::size_t mapSize = 0;
 	};
 
 	class Transaction final
@@ -63,13 +95,28 @@ namespace rinhaback::api
 	public:
 		explicit Transaction(Connection& connection, int flags)
 			: connection(connection),
-			  flags(flags)
+			  flags(flags),
+			  mapLock(connection.mapMutex)
 		{
-			checkMdbError(mdb_txn_begin(connection.env, nullptr, flags, &txn));
+			int rc;
+
+			while ((rc = mdb_txn_begin(connection.env, nullptr, flags, &txn)) == MDB_MAP_RESIZED)
+			{
+				mapLock.unlock();
+				connection.adoptMapSize();
+				mapLock.lock();
+			}
+
+			checkMdbError(rc);
+			mapSize = connection.mapSize;
+			generation = getActiveGeneration();
 		}
 
 		~Transaction()
 		{
+			if (!txn)
+				return;
+
 			if (flags & MDB_RDONLY)
 				mdb_txn_abort(txn);
 			else
@@ -79,10 +126,168 @@ namespace rinhaback::api
 		Transaction(const Transaction&) = delete;
 		Transaction& operator=(const Transaction&) = delete;
 
+	public:
+		// Ends the transaction before its destruction, returning the result of the commit
+		int commit()
+		{
+			const int rc = mdb_txn_commit(txn);
+			txn = nullptr;
+			mapLock.unlock();
+			return rc;
+		}
+
+		void abort()
+		{
+			mdb_txn_abort(txn);
+			txn = nullptr;
+			mapLock.unlock();
+		}
+
+		MDB_dbi getDbi(PaymentGateway gateway) const
+		{
+			return connection.dbis[generation][std::to_underlying(gateway)];
+		}
+
 	public:
 		Connection& connection;
 		MDB_txn* txn;
 		const int flags;
+		unsigned generation;
+		std::size_t mapSize;
+
+	private:
+		std::shared_lock<std::shared_mutex> mapLock;
+	};
+
+	// Read-only transaction taken from the ones each thread keeps for each connection. Destroying it only resets
+	// the transaction, which releases its snapshot but keeps its slot in the reader table, so the next use renews
+	// it and its cursors instead of beginning a new one.
+	class ReadTransaction final
+	{
+	private:
+		struct Cache final
+		{
+			Cache() = default;
+
+			Cache(const Cache&) = delete;
+			Cache& operator=(const Cache&) = delete;
+
+			~Cache()
+			{
+				close();
+			}
+
+			// Begins or renews the transaction and its cursors, discarding them when that fails
+			int begin(MDB_env* env)
+			{
+				int rc;
+
+				if (!txn)
+					rc = mdb_txn_begin(env, nullptr, MDB_RDONLY, &txn);
+				else
+				{
+					rc = mdb_txn_renew(txn);
+
+					for (const auto& generationCursors : cursors)
+					{
+						for (const auto cursor : generationCursors)
+						{
+							if (rc == 0 && cursor)
+								rc = mdb_cursor_renew(txn, cursor);
+						}
+					}
+
+					if (rc != 0)
+						close();
+				}
+
+				return rc;
+			}
+
+			void close()
+			{
+				for (auto& generationCursors : cursors)
+				{
+					for (auto& cursor : generationCursors)
+					{
+						if (cursor)
+							mdb_cursor_close(cursor);
+
+						cursor = nullptr;
+					}
+				}
+
+				if (txn)
+					mdb_txn_abort(txn);
+
+				txn = nullptr;
+			}
+
+			MDB_txn* txn = nullptr;
+			std::array<std::array<MDB_cursor*, std::to_underlying(PaymentGateway::SIZE)>, DATABASE_GENERATIONS>
+				cursors{};
+		};
+
+	public:
+		explicit ReadTransaction(Connection& connection)
+			: connection(connection),
+			  cache(getCache(connection)),
+			  mapLock(connection.mapMutex)
+		{
+			int rc;
+
+			while ((rc = cache.begin(connection.env)) == MDB_MAP_RESIZED)
+			{
+				mapLock.unlock();
+				connection.adoptMapSize();
+				mapLock.lock();
+			}
+
+			checkMdbError(rc);
+
+			txn = cache.txn;
+			generation = getActiveGeneration();
+		}
+
+		~ReadTransaction()
+		{
+			mdb_txn_reset(txn);
+		}
+
+		ReadTransaction(const ReadTransaction&) = delete;
+		ReadTransaction& operator=(const ReadTransaction&) = delete;
+
+	public:
+		MDB_dbi getDbi(PaymentGateway gateway) const
+		{
+			return connection.dbis[generation][std::to_underlying(gateway)];
+		}
+
+		MDB_cursor* getCursor(PaymentGateway gateway)
+		{
+			auto& cursor = cache.cursors[generation][std::to_underlying(gateway)];
+
+			if (!cursor)
+				checkMdbError(mdb_cursor_open(txn, getDbi(gateway), &cursor));
+
+			return cursor;
+		}
+
+	private:
+		static Cache& getCache(const Connection& connection)
+		{
+			thread_local std::map<const Connection*, Cache> caches;
+			return caches[&connection];
+		}
+
+	public:
+		Connection& connection;
+		MDB_txn* txn;
+		unsigned generation;
+
+	private:
+		Cache& cache;
+		std::shared_lock<std::shared_mutex> mapLock;
 	};
 
 	inline Connection& getConnection()
@@ -90,4 +295,8 @@ namespace rinhaback::api
 		static Connection connection;
 		return connection;
 	}
+
+	// The databases of all API instances, starting with this one. With PER_INSTANCE_DATABASE, instances are found
+	// by their directories, so the ones that started since the last call are included.
+	std::vector<Connection*> getInstanceConnections();
 }  // namespace rinhaback::api
@@ -0,0 +1,213 @@
+#pragma once
+
+#include <algorithm>
+#include <charconv>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <cstddef>
+
+
+namespace rinhaback::api
+{
+	inline constexpr std::string_view HTTP_RESPONSE_OK = "HTTP/1.1 200 OK\r\n"
+														 "Content-Length: 0\r\n"
+														 "\r\n";
+
+	inline constexpr std::string_view HTTP_RESPONSE_NOT_FOUND = "HTTP/1.1 404 Not Found\r\n"
+																"Content-Length: 0\r\n"
+																"\r\n";
+
+	inline constexpr std::string_view HTTP_RESPONSE_BAD_REQUEST = "HTTP/1.1 400 Bad Request\r\n"
+																  "Content-Length: 0\r\n"
+																  "\r\n";
+
+	inline constexpr std::string_view HTTP_RESPONSE_INTERNAL_SERVER_ERROR = "HTTP/1.1 500 Internal Server Error\r\n"
+																			"Content-Length: 0\r\n"
+																			"\r\n";
+
+	// Minimal HTTP/1.1 request tokenizer for the API routes. It works in place over the receive buffer and only
+	// looks at the request line and the Content-Length header, as the API answers a single request per connection.
+	// Anything else that could change how the request must be read (chunked bodies, Expect, oversized or malformed
+	// requests) is UNSUPPORTED and should go through Beast.
+	class FastHttpRequest final
+	{
+	public:
+		enum class Method
+		{
+			GET,
+			POST
+		};
+
+		enum class ParseResult
+		{
+			COMPLETE,
+			INCOMPLETE,
+			UNSUPPORTED
+		};
+
+	public:
+		static constexpr std::size_t MAX_SIZE = 4096;
+
+	public:
+		ParseResult parse(std::string_view data)
+		{
+			const auto headersEnd = data.find("\r\n\r\n");
+
+			if (headersEnd == std::string_view::npos)
+				return data.size() < MAX_SIZE ? ParseResult::INCOMPLETE : ParseResult::UNSUPPORTED;
+
+			auto lines = data.substr(0, headersEnd + 2);
+
+			if (!parseRequestLine(nextLine(lines)))
+				return ParseResult::UNSUPPORTED;
+
+			std::optional<std::size_t> contentLength;
+
+			while (!lines.empty())
+			{
+				const auto line = nextLine(lines);
+				const auto colon = line.find(':');
+
+				if (colon == std::string_view::npos)
+					return ParseResult::UNSUPPORTED;
+
+				const auto name = line.substr(0, colon);
+				const auto value = trim(line.substr(colon + 1));
+
+				if (equalsIgnoreCase(name, "content-length"))
+				{
+					std::size_t length;
+					const auto [end, ec] = std::from_chars(value.data(), value.data() + value.size(), length);
+
+					if (contentLength || ec != std::errc() || end != value.data() + value.size())
+						return ParseResult::UNSUPPORTED;
+
+					contentLength = length;
+				}
+				else if (equalsIgnoreCase(name, "transfer-encoding") || equalsIgnoreCase(name, "expect"))
+					return ParseResult::UNSUPPORTED;
+			}
+
+			const auto bodyStart = headersEnd + 4;
+			const auto bodyLength = contentLength.value_or(0);
+
+			if (bodyLength > MAX_SIZE)
+				return ParseResult::UNSUPPORTED;
+
+			if (data.size() - bodyStart < bodyLength)
+				return ParseResult::INCOMPLETE;
+
+			body = data.substr(bodyStart, bodyLength);
+
+			return ParseResult::COMPLETE;
+		}
+
+		// Returns the percent-decoded value of a query string parameter
+		std::optional<std::string> getQueryParam(std::string_view name) const
+		{
+			auto remaining = query;
+
+			while (!remaining.empty())
+			{
+				const auto ampersand = remaining.find('&');
+				const auto param = remaining.substr(0, ampersand);
+				remaining = ampersand == std::string_view::npos ? std::string_view() : remaining.substr(ampersand + 1);
+
+				if (param.size() > name.size() && param.starts_with(name) && param[name.size()] == '=')
+					return decode(param.substr(name.size() + 1));
+			}
+
+			return std::nullopt;
+		}
+
+	private:
+		bool parseRequestLine(std::string_view line)
+		{
+			const auto methodEnd = line.find(' ');
+			const auto targetEnd = line.rfind(' ');
+
+			if (methodEnd == std::string_view::npos || targetEnd == methodEnd)
+				return false;
+
+			const auto methodName = line.substr(0, methodEnd);
+			const auto version = line.substr(targetEnd + 1);
+
+			if (methodName == "GET")
+				method = Method::GET;
+			else if (methodName == "POST")
+				method = Method::POST;
+			else
+				return false;
+
+			if (version != "HTTP/1.1" && version != "HTTP/1.0")
+				return false;
+
+			const auto target = line.substr(methodEnd + 1, targetEnd - methodEnd - 1);
+
+			if (!target.starts_with('/'))
+				return false;
+
+			const auto questionMark = target.find('?');
+			path = target.substr(0, questionMark);
+			query = questionMark == std::string_view::npos ? std::string_view() : target.substr(questionMark + 1);
+
+			return true;
+		}
+
+		static std::string_view nextLine(std::string_view& lines)
+		{
+			const auto lineEnd = lines.find("\r\n");
+			const auto line = lines.substr(0, lineEnd);
+			lines.remove_prefix(lineEnd + 2);
+			return line;
+		}
+
+		static std::string_view trim(std::string_view str)
+		{
+			while (!str.empty() && (str.front() == ' ' || str.front() == '\t'))
+				str.remove_prefix(1);
+
+			while (!str.empty() && (str.back() == ' ' || str.back() == '\t'))
+				str.remove_suffix(1);
+
+			return str;
+		}
+
+		static bool equalsIgnoreCase(std::string_view str, std::string_view lowerCase)
+		{
+			return std::ranges::equal(str, lowerCase,
+				[](char c1, char c2) { return (c1 >= 'A' && c1 <= 'Z' ? c1 - 'A' + 'a' : c1) == c2; });
+		}
+
+		static std::string decode(std::string_view str)
+		{
+			std::string decoded;
+			decoded.reserve(str.size());
+
+			for (std::size_t i = 0; i < str.size(); ++i)
+			{
+				unsigned char c;
+
+				if (str[i] == '%' && i + 2 < str.size() &&
+					std::from_chars(str.data() + i + 1, str.data() + i + 3, c, 16).ptr == str.data() + i + 3)
+				{
+					i += 2;
+				}
+				else
+					c = str[i] == '+' ? ' ' : str[i];
+
+				decoded.push_back(static_cast<char>(c));
+			}
+
+			return decoded;
+		}
+
+	public:
+		Method method = Method::GET;
+		std::string_view path;
+		std::string_view query;
+		std::string_view body;
+	};
+}  // namespace rinhaback::api
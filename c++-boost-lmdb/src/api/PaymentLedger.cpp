@@ -0,0 +1,234 @@
+#include "./PaymentLedger.h"
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+#include <thread>
+#include <cmath>
+
+
+namespace rinhaback::api
+{
+	static constexpr std::size_t alignUp(std::size_t value, std::size_t alignment)
+	{
+		return (value + alignment - 1) / alignment * alignment;
+	}
+
+	static void storeMin(std::atomic_int64_t& target, std::int64_t value)
+	{
+		auto current = target.load(std::memory_order_relaxed);
+
+		while ((current == 0 || value < current) &&
+			!target.compare_exchange_weak(current, value, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	static void storeMax(std::atomic_int64_t& target, std::int64_t value)
+	{
+		auto current = target.load(std::memory_order_relaxed);
+
+		while (value > current && !target.compare_exchange_weak(current, value, std::memory_order_relaxed))
+		{
+		}
+	}
+
+	// Branchless, so the compiler vectorizes it
+	static void sumRows(const std::int64_t* dateTimes, const std::int64_t* amountsInCents, std::size_t count,
+		std::int64_t from, std::int64_t to, std::uint64_t& totalRequests, std::int64_t& totalAmountInCents)
+	{
+		std::uint64_t requests = 0;
+		std::int64_t amountInCents = 0;
+
+		for (std::size_t i = 0; i < count; ++i)
+		{
+			const bool inRange = (dateTimes[i] >= from) & (dateTimes[i] <= to);
+			requests += inRange;
+			amountInCents += inRange ? amountsInCents[i] : 0;
+		}
+
+		totalRequests += requests;
+		totalAmountInCents += amountInCents;
+	}
+
+	PaymentLedger::PaymentLedger(std::size_t capacity)
+		: capacity(alignUp(std::max<std::size_t>(capacity, 1), BLOCK_SIZE)),
+		  shm(boost::interprocess::open_or_create, SHARED_MEMORY_NAME, boost::interprocess::read_write)
+	{
+		const auto blockCount = this->capacity / BLOCK_SIZE;
+
+		const auto blocksOffset = alignUp(sizeof(Header), 64);
+		const auto dateTimesOffset = alignUp(blocksOffset + blockCount * sizeof(Block), 64);
+		const auto amountsOffset = alignUp(dateTimesOffset + this->capacity * sizeof(std::int64_t), 64);
+		const auto correlationIdsOffset = alignUp(amountsOffset + this->capacity * sizeof(std::int64_t), 64);
+		const auto gatewaySize = alignUp(correlationIdsOffset + this->capacity * sizeof(CorrelationId), 4096);
+
+		// Zero-filled when created, which is the empty state. An existing one holds the payments of the other
+		// instance, which is still running, so it's not purged here.
+		shm.truncate(static_cast<boost::interprocess::offset_t>(gatewaySize * gateways.size()));
+		region = boost::interprocess::mapped_region(shm, boost::interprocess::read_write);
+
+		for (std::size_t i = 0; i < gateways.size(); ++i)
+		{
+			const auto base = static_cast<std::byte*>(region.get_address()) + i * gatewaySize;
+
+			gateways[i] = {
+				.header = reinterpret_cast<Header*>(base),
+				.blocks = reinterpret_cast<Block*>(base + blocksOffset),
+				.dateTimes = reinterpret_cast<std::int64_t*>(base + dateTimesOffset),
+				.amountsInCents = reinterpret_cast<std::int64_t*>(base + amountsOffset),
+				.correlationIds = reinterpret_cast<CorrelationId*>(base + correlationIdsOffset),
+			};
+		}
+	}
+
+	void PaymentLedger::postPayment(
+		PaymentGateway gateway, double amount, const CorrelationId& correlationId, DateTimeMillis requestedAt)
+	{
+		auto& columns = gateways[std::to_underlying(gateway)];
+
+		while (true)
+		{
+			const auto epoch = columns.header->epoch.load();
+
+			if (epoch % 2 == 0)
+			{
+				columns.header->writers.fetch_add(1);
+
+				if (columns.header->epoch.load() == epoch)
+					break;
+
+				columns.header->writers.fetch_sub(1);
+			}
+
+			std::this_thread::yield();
+		}
+
+		const auto row = columns.header->reserved.fetch_add(1, std::memory_order_relaxed);
+
+		if (row >= capacity)
+		{
+			columns.header->writers.fetch_sub(1);
+			throw std::runtime_error("Payment ledger is full");
+		}
+
+		const auto dateTime = requestedAt.time_since_epoch().count();
+
+		columns.amountsInCents[row] = std::llround(amount * 100);
+		columns.correlationIds[row] = correlationId;
+		std::atomic_ref(columns.dateTimes[row]).store(dateTime, std::memory_order_release);
+
+		auto& block = columns.blocks[row / BLOCK_SIZE];
+		storeMin(block.minDateTime, dateTime);
+		storeMax(block.maxDateTime, dateTime);
+		block.committed.fetch_add(1, std::memory_order_release);
+
+		columns.header->writers.fetch_sub(1);
+	}
+
+	PaymentRepository::PaymentsGatewaySummaryResponse PaymentLedger::getPaymentsSummary(
+		PaymentGateway gateway, std::optional<std::int64_t> from, std::optional<std::int64_t> to)
+	{
+		const auto& columns = gateways[std::to_underlying(gateway)];
+
+		while (true)
+		{
+			const auto epoch = columns.header->epoch.load();
+
+			if (epoch % 2 == 0)
+			{
+				const auto response = sumPayments(columns, from, to);
+
+				if (columns.header->epoch.load() == epoch)
+					return response;
+			}
+
+			std::this_thread::yield();
+		}
+	}
+
+	PaymentRepository::PaymentsGatewaySummaryResponse PaymentLedger::sumPayments(
+		const Columns& columns, std::optional<std::int64_t> from, std::optional<std::int64_t> to)
+	{
+		const auto rows = std::min<std::size_t>(columns.header->reserved.load(std::memory_order_acquire), capacity);
+
+		// Unwritten rows have a zero timestamp, which this range excludes
+		const auto fromValue = std::max<std::int64_t>(from.value_or(1), 1);
+		const auto toValue = to.value_or(std::numeric_limits<std::int64_t>::max());
+
+		std::uint64_t totalRequests = 0;
+		std::int64_t totalAmountInCents = 0;
+
+		for (std::size_t blockStart = 0; blockStart < rows; blockStart += BLOCK_SIZE)
+		{
+			const auto& block = columns.blocks[blockStart / BLOCK_SIZE];
+			const auto dateTimes = columns.dateTimes + blockStart;
+			const auto amountsInCents = columns.amountsInCents + blockStart;
+
+			if (block.committed.load(std::memory_order_acquire) == BLOCK_SIZE)
+			{
+				const auto minDateTime = block.minDateTime.load(std::memory_order_relaxed);
+				const auto maxDateTime = block.maxDateTime.load(std::memory_order_relaxed);
+
+				if (maxDateTime < fromValue || minDateTime > toValue)
+					continue;
+
+				sumRows(dateTimes, amountsInCents, BLOCK_SIZE, fromValue, toValue, totalRequests, totalAmountInCents);
+			}
+			else
+			{
+				// Rows of the last block may still be being written, so only the published ones are taken
+				const auto blockRows = std::min(BLOCK_SIZE, rows - blockStart);
+
+				for (std::size_t i = 0; i < blockRows; ++i)
+				{
+					const auto dateTime = std::atomic_ref(dateTimes[i]).load(std::memory_order_acquire);
+
+					if (dateTime >= fromValue && dateTime <= toValue)
+					{
+						++totalRequests;
+						totalAmountInCents += amountsInCents[i];
+					}
+				}
+			}
+		}
+
+		return {
+			.totalRequests = static_cast<unsigned>(totalRequests),
+			.totalAmount = static_cast<double>(totalAmountInCents) / 100,
+		};
+	}
+
+	void PaymentLedger::purge()
+	{
+		for (auto& columns : gateways)
+		{
+			// Odd until the purge ends, so new writers and a concurrent purge wait for it
+			auto epoch = columns.header->epoch.load();
+
+			while (epoch % 2 != 0 || !columns.header->epoch.compare_exchange_weak(epoch, epoch + 1))
+			{
+				std::this_thread::yield();
+				epoch = columns.header->epoch.load();
+			}
+
+			// Rows reserved before are written first
+			while (columns.header->writers.load() != 0)
+				std::this_thread::yield();
+
+			const auto rows = std::min<std::size_t>(columns.header->reserved.load(std::memory_order_relaxed), capacity);
+
+			std::fill_n(columns.dateTimes, rows, 0);
+
+			for (std::size_t i = 0; i < (rows + BLOCK_SIZE - 1) / BLOCK_SIZE; ++i)
+			{
+				auto& block = columns.blocks[i];
+				block.committed.store(0, std::memory_order_relaxed);
+				block.minDateTime.store(0, std::memory_order_relaxed);
+				block.maxDateTime.store(0, std::memory_order_relaxed);
+			}
+
+			columns.header->reserved.store(0, std::memory_order_relaxed);
+			columns.header->epoch.store(epoch + 2);
+		}
+	}
+}  // namespace rinhaback::api
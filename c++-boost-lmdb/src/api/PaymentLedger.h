@@ -0,0 +1,84 @@
+#pragma once
+
+#include "./Database.h"
+#include "./PaymentRepository.h"
+#include "./Util.h"
+#include <array>
+#include <atomic>
+#include <optional>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include "boost/interprocess/mapped_region.hpp"
+#include "boost/interprocess/shared_memory_object.hpp"
+
+
+namespace rinhaback::api
+{
+	// Append-only payment storage shared by the API instances. Each gateway has, in shared memory, separate columns
+	// of timestamps, amounts in cents and correlation ids, and appends reserve their row with an atomic increment.
+	// Payments complete out of order, so the timestamp column is not sorted. Rows are grouped in blocks instead,
+	// with the range of their timestamps, which lets summaries skip the blocks out of the requested range.
+	//
+	// Each row of the capacity takes 52 bytes of /dev/shm per gateway. The default capacity fits in the 64 MB Docker
+	// gives by default; going over it raises SIGBUS when the pages are first touched, so larger ones need shm_size.
+	//
+	// Purges and accesses are ordered by an epoch per gateway that is odd while a purge is running. Writers announce
+	// themselves before reserving a row and back off if a purge started meanwhile, so a purge waits for the rows
+	// already reserved to be written before clearing them. Summaries are taken again if a purge ran while reading.
+	class PaymentLedger final
+	{
+	private:
+		static constexpr const char* SHARED_MEMORY_NAME = "rinhaback25-boost-lmdb-PaymentLedger";
+		static constexpr std::size_t BLOCK_SIZE = 1024;
+
+		struct alignas(64) Header final
+		{
+			std::atomic_uint64_t reserved;
+			std::atomic_uint64_t epoch;
+			std::atomic_uint32_t writers;
+		};
+
+		// minDateTime and maxDateTime are zero while unset, as timestamps are never zero
+		struct alignas(64) Block final
+		{
+			std::atomic_uint32_t committed;
+			std::atomic_int64_t minDateTime;
+			std::atomic_int64_t maxDateTime;
+		};
+
+		struct Columns final
+		{
+			Header* header;
+			Block* blocks;
+			std::int64_t* dateTimes;
+			std::int64_t* amountsInCents;
+			CorrelationId* correlationIds;
+		};
+
+	public:
+		explicit PaymentLedger(std::size_t capacity);
+
+		PaymentLedger(const PaymentLedger&) = delete;
+		PaymentLedger& operator=(const PaymentLedger&) = delete;
+
+	public:
+		void postPayment(
+			PaymentGateway gateway, double amount, const CorrelationId& correlationId, DateTimeMillis requestedAt);
+
+		PaymentRepository::PaymentsGatewaySummaryResponse getPaymentsSummary(
+			PaymentGateway gateway, std::optional<std::int64_t> from, std::optional<std::int64_t> to);
+
+		void purge();
+
+	private:
+		PaymentRepository::PaymentsGatewaySummaryResponse sumPayments(
+			const Columns& columns, std::optional<std::int64_t> from, std::optional<std::int64_t> to);
+
+	private:
+		std::size_t capacity;
+		boost::interprocess::shared_memory_object shm;
+		boost::interprocess::mapped_region region;
+		std::array<Columns, std::to_underlying(PaymentGateway::SIZE)> gateways;
+	};
+}  // namespace rinhaback::api
@@ -3,6 +3,8 @@
 #include "./GatewayChooserService.h"
 #include "./SignalHandling.h"
 #include "./Util.h"
+#include "../common/LoadStats.h"
+#include <atomic>
 #include <format>
 #include <mutex>
 #include <print>
@@ -66,7 +68,10 @@ namespace rinhaback::api
 			const auto optionalPayment = pendingPaymentsQueue->dequeue();
 
 			if (optionalPayment.has_value())
+			{
+				InFlightPaymentGuard inFlightGuard(LoadStats::get().getInstance(Config::instanceId));
 				co_await processPayment(optionalPayment.value());
+			}
 		}
 
 		std::println("PaymentProcessor stopped.");
@@ -1,10 +1,12 @@
 #include "./PaymentRepository.h"
 #include "./Config.h"
 #include "./Database.h"
+#include "./PaymentTotals.h"
 #include "./Util.h"
 #include <string>
 #include <utility>
 #include <cassert>
+#include <cmath>
 #include <cstring>
 
 
@@ -19,18 +21,52 @@ namespace rinhaback::api
 
 		PaymentData data{.amount = amount, .correlationId = correlationId};
 
-		Transaction transaction(connection, 0);
-
 		MDB_val mdbKey(sizeof(key), &key);
 		MDB_val mdbData(sizeof(data), &data);
-		checkMdbError(mdb_put(transaction.txn, connection.dbis[std::to_underlying(gateway)], &mdbKey, &mdbData, 0));
+
+		std::optional<PaymentTotals::Writer> totalsWriter;
+
+		while (true)
+		{
+			Transaction transaction(connection, 0);
+			const auto dbi = transaction.getDbi(gateway);
+
+			// Timestamps mostly arrive in order, and appending skips the B-tree descent and fills the last page
+			// instead of splitting it in half. Keys not after the last one, including a repeated last key, are
+			// refused with MDB_KEYEXIST and take the regular path.
+			int rc = mdb_put(transaction.txn, dbi, &mdbKey, &mdbData, MDB_APPEND);
+
+			if (rc == MDB_KEYEXIST)
+				rc = mdb_put(transaction.txn, dbi, &mdbKey, &mdbData, 0);
+
+			if (rc == 0)
+			{
+				if (Config::summaryTotals)
+					totalsWriter.emplace(PaymentTotals::get(), transaction.generation);
+
+				rc = transaction.commit();
+			}
+			else
+				transaction.abort();
+
+			if (rc != MDB_MAP_FULL)
+			{
+				checkMdbError(rc);
+				break;
+			}
+
+			// Written again after the map is grown
+			totalsWriter.reset();
+			connection.growMap(transaction.mapSize);
+		}
+
+		if (totalsWriter)
+			totalsWriter->add(gateway, key.dateTime, std::llround(amount * 100));
 	}
 
 	PaymentRepository::PaymentsGatewaySummaryResponse PaymentRepository::getPaymentsSummary(
-		Transaction& transaction, std::optional<std::int64_t> from, std::optional<std::int64_t> to)
+		ReadTransaction& transaction, std::optional<std::int64_t> from, std::optional<std::int64_t> to)
 	{
-		auto& connection = transaction.connection;
-
 		PaymentsGatewaySummaryResponse response = {
 			.totalRequests = 0,
 			.totalAmount = 0.0,
@@ -41,15 +77,13 @@ namespace rinhaback::api
 		MDB_val mdbKey(sizeof(initialKey), &initialKey);
 		MDB_val mdbData;
 
-		MDB_cursor* cursor;
-		checkMdbError(mdb_cursor_open(transaction.txn, connection.dbis[std::to_underlying(gateway)], &cursor));
+		// Owned by the transaction cache, so it's not closed here
+		const auto cursor = transaction.getCursor(gateway);
 
 		int rc = mdb_cursor_get(cursor, &mdbKey, &mdbData, (from ? MDB_SET_RANGE : MDB_FIRST));
 
 		if (rc != 0)
 		{
-			mdb_cursor_close(cursor);
-
 			if (rc != MDB_NOTFOUND)
 				checkMdbError(rc);
 
@@ -73,19 +107,75 @@ namespace rinhaback::api
 			rc = mdb_cursor_get(cursor, &mdbKey, &mdbData, MDB_NEXT);
 		}
 
-		mdb_cursor_close(cursor);
-
 		if (rc != MDB_NOTFOUND)
 			checkMdbError(rc);
 
 		return response;
 	};
 
-	void PaymentRepository::purge()
+	std::optional<PaymentRepository::KeyRange> PaymentRepository::getKeyRange(ReadTransaction& transaction)
 	{
-		auto& connection = getConnection();
-		Transaction transaction(connection, 0);
+		const auto cursor = transaction.getCursor(gateway);
+
+		MDB_val mdbKey;
+		MDB_val mdbData;
+
+		int rc = mdb_cursor_get(cursor, &mdbKey, &mdbData, MDB_FIRST);
+
+		if (rc == MDB_NOTFOUND)
+			return std::nullopt;
+
+		checkMdbError(rc);
+
+		const auto first = static_cast<const PaymentKey*>(mdbKey.mv_data)->dateTime;
+
+		checkMdbError(mdb_cursor_get(cursor, &mdbKey, &mdbData, MDB_LAST));
+
+		const auto last = static_cast<const PaymentKey*>(mdbKey.mv_data)->dateTime;
+
+		MDB_stat stat;
+		checkMdbError(mdb_stat(transaction.txn, transaction.getDbi(gateway), &stat));
+
+		return KeyRange{
+			.first = first,
+			.last = last,
+			.entries = stat.ms_entries,
+		};
+	}
+
+	void PaymentRepository::purge(Transaction& transaction, unsigned generation)
+	{
+		checkMdbError(
+			mdb_drop(transaction.txn, transaction.connection.dbis[generation][std::to_underlying(gateway)], 0));
+	}
+
+	bool PaymentRepository::purgeChunk(Transaction& transaction, unsigned generation, std::size_t maxEntries)
+	{
+		MDB_cursor* cursor;
+		checkMdbError(mdb_cursor_open(
+			transaction.txn, transaction.connection.dbis[generation][std::to_underlying(gateway)], &cursor));
+
+		MDB_val mdbKey;
+		MDB_val mdbData;
+		int rc = 0;
+
+		for (std::size_t i = 0; i < maxEntries && (rc = mdb_cursor_get(cursor, &mdbKey, &mdbData, MDB_FIRST)) == 0;
+			 ++i)
+		{
+			if ((rc = mdb_cursor_del(cursor, 0)) != 0)
+				break;
+		}
+
+		if (rc == 0)
+			rc = mdb_cursor_get(cursor, &mdbKey, &mdbData, MDB_FIRST);
+
+		mdb_cursor_close(cursor);
+
+		if (rc == MDB_NOTFOUND)
+			return false;
+
+		checkMdbError(rc);
 
-		checkMdbError(mdb_drop(transaction.txn, connection.dbis[std::to_underlying(gateway)], 0));
+		return true;
 	}
 }  // namespace rinhaback::api
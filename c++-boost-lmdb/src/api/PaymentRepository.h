@@ -3,6 +3,7 @@
 #include "./Database.h"
 #include "./Util.h"
 #include <optional>
+#include <cstddef>
 #include <cstdint>
 
 
@@ -17,6 +18,13 @@ namespace rinhaback::api
 			double totalAmount;
 		};
 
+		struct KeyRange final
+		{
+			std::int64_t first;
+			std::int64_t last;
+			std::size_t entries;
+		};
+
 	private:
 		struct __attribute__((packed)) PaymentKey final
 		{
@@ -42,9 +50,16 @@ namespace rinhaback::api
 		void postPayment(double amount, const CorrelationId& correlationId, DateTimeMillis requestedAt);
 
 		PaymentsGatewaySummaryResponse getPaymentsSummary(
-			Transaction& transaction, std::optional<std::int64_t> from, std::optional<std::int64_t> to);
+			ReadTransaction& transaction, std::optional<std::int64_t> from, std::optional<std::int64_t> to);
+
+		// First and last timestamps stored and the number of payments, or nothing when empty
+		std::optional<KeyRange> getKeyRange(ReadTransaction& transaction);
+
+		// Empties the database of a generation
+		void purge(Transaction& transaction, unsigned generation);
 
-		void purge();
+		// Deletes up to maxEntries payments of a generation, returning whether others remain
+		bool purgeChunk(Transaction& transaction, unsigned generation, std::size_t maxEntries);
 
 	private:
 		PaymentGateway gateway;
@@ -1,14 +1,99 @@
 #include "./PaymentService.h"
+#include "./Config.h"
+#include "./PaymentTotals.h"
 #include "./Util.h"
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <future>
+#include <latch>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <cstddef>
+#include "boost/asio/post.hpp"
 
 
 namespace rinhaback::api
 {
+	namespace
+	{
+		struct SummaryPartition final
+		{
+			Connection* connection;
+			PaymentGateway gateway;
+			std::int64_t from;
+			std::int64_t to;
+			PaymentRepository::PaymentsGatewaySummaryResponse result{};
+			std::exception_ptr exception;
+		};
+
+		// Partitions are claimed one at a time by the requesting thread and by the helpers posted to the handler
+		// pool. The requesting thread only waits for partitions already being scanned, so summaries can't deadlock
+		// when they occupy all the pool threads; helpers that start late find nothing left and return.
+		struct SummaryJob final
+		{
+			explicit SummaryJob(std::vector<SummaryPartition> partitions)
+				: partitions(std::move(partitions)),
+				  done(static_cast<std::ptrdiff_t>(this->partitions.size()))
+			{
+			}
+
+			std::vector<SummaryPartition> partitions;
+			std::atomic_size_t next{0};
+			std::latch done;
+		};
+	}  // namespace
+
+	static void runSummaryPartitions(SummaryJob& job, PaymentRepository* repositories)
+	{
+		for (auto i = job.next.fetch_add(1, std::memory_order_relaxed); i < job.partitions.size();
+			 i = job.next.fetch_add(1, std::memory_order_relaxed))
+		{
+			auto& partition = job.partitions[i];
+
+			try
+			{
+				ReadTransaction transaction(*partition.connection);
+				partition.result = repositories[std::to_underlying(partition.gateway)].getPaymentsSummary(
+					transaction, partition.from, partition.to);
+			}
+			catch (...)
+			{
+				partition.exception = std::current_exception();
+			}
+
+			job.done.count_down();
+		}
+	}
+
+	static constexpr std::size_t RECLAIM_CHUNK_SIZE = 1024;
+
+	PaymentService::PaymentService()
+	{
+		if (Config::ledgerStorage)
+			ledger = std::make_unique<PaymentLedger>(Config::ledgerCapacity);
+		else if (Config::coordinator && Config::summaryTotals)
+		{
+			// The coordinator recreates the database, so totals left by a previous run are dropped. The other
+			// instances don't write before the coordinator's connection is ready, which comes after this.
+			for (unsigned generation = 0; generation < DATABASE_GENERATIONS; ++generation)
+				PaymentTotals::get().reset(generation);
+		}
+	}
+
 	void PaymentService::postPayment(
 		PaymentGateway gateway, double amount, const CorrelationId& correlationId, DateTimeMillis requestedAt)
 	{
-		auto& repository = repositories[std::to_underlying(gateway)];
-		repository.postPayment(amount, correlationId, requestedAt);
+		if (ledger)
+			ledger->postPayment(gateway, amount, correlationId, requestedAt);
+		else
+		{
+			auto& repository = repositories[std::to_underlying(gateway)];
+			repository.postPayment(amount, correlationId, requestedAt);
+		}
+
+		WriteGenerations::get().bump(gateway);
 	}
 
 	PaymentService::PaymentsSummaryResponse PaymentService::getPaymentsSummary(
@@ -19,22 +104,332 @@ namespace rinhaback::api
 		const std::optional<std::int64_t> toInt =
 			to.has_value() ? std::make_optional(to->time_since_epoch().count()) : std::nullopt;
 
-		Connection& connection = getConnection();
-		Transaction transaction(connection, MDB_RDONLY);
+		if (Config::summaryCacheSize > 0)
+			return getCachedPaymentsSummary(fromInt, toInt);
 
-		PaymentsSummaryResponse response{
-			.defaultGateway = repositories[std::to_underlying(PaymentGateway::DEFAULT)].getPaymentsSummary(
-				transaction, fromInt, toInt),
-			.fallbackGateway = repositories[std::to_underlying(PaymentGateway::FALLBACK)].getPaymentsSummary(
-				transaction, fromInt, toInt),
-		};
+		return scanPaymentsSummary(fromInt, toInt);
+	};
+
+	PaymentService::PaymentsSummaryResponse PaymentService::getCachedPaymentsSummary(
+		std::optional<std::int64_t> from, std::optional<std::int64_t> to)
+	{
+		const auto generations = WriteGenerations::get().load();
+		std::promise<PaymentsSummaryResponse> promise;
+		std::shared_future<PaymentsSummaryResponse> summary;
+		std::uint64_t scanId = 0;
+
+		{  // scope
+			std::unique_lock lock(summaryCacheMutex);
+
+			const auto cached = std::ranges::find_if(
+				summaryCache, [&](const CachedSummary& entry) { return entry.from == from && entry.to == to; });
+
+			if (cached != summaryCache.end() && cached->generations == generations)
+			{
+				cached->lastUsed = ++summaryCacheClock;
+				summary = cached->summary;
+			}
+			else
+			{
+				scanId = ++summaryCacheClock;
+
+				CachedSummary entry{
+					.from = from,
+					.to = to,
+					.generations = generations,
+					.summary = promise.get_future().share(),
+					.scanId = scanId,
+					.lastUsed = scanId,
+				};
+
+				if (cached != summaryCache.end())
+					*cached = std::move(entry);
+				else if (summaryCache.size() < Config::summaryCacheSize)
+					summaryCache.push_back(std::move(entry));
+				else
+					*std::ranges::min_element(summaryCache, {}, &CachedSummary::lastUsed) = std::move(entry);
+			}
+		}
+
+		// Hit or computed by another request
+		if (summary.valid())
+			return summary.get();
+
+		try
+		{
+			const auto response = scanPaymentsSummary(from, to);
+			promise.set_value(response);
+			return response;
+		}
+		catch (...)
+		{
+			promise.set_exception(std::current_exception());
+
+			// Failures are not cached, but the requests already waiting for this scan get them
+			std::unique_lock lock(summaryCacheMutex);
+			std::erase_if(summaryCache, [&](const CachedSummary& entry) { return entry.scanId == scanId; });
+
+			throw;
+		}
+	}
+
+	PaymentService::PaymentsSummaryResponse PaymentService::scanPaymentsSummary(
+		std::optional<std::int64_t> fromInt, std::optional<std::int64_t> toInt)
+	{
+		if (ledger)
+		{
+			return {
+				.defaultGateway = ledger->getPaymentsSummary(PaymentGateway::DEFAULT, fromInt, toInt),
+				.fallbackGateway = ledger->getPaymentsSummary(PaymentGateway::FALLBACK, fromInt, toInt),
+			};
+		}
+
+		if (Config::summaryTotals)
+		{
+			if (const auto response = getTotalsPaymentsSummary(fromInt, toInt))
+				return response.value();
+		}
+
+		if (summaryExecutor && Config::summaryParallelism > 1)
+			return getPartitionedPaymentsSummary(fromInt, toInt);
+
+		PaymentsSummaryResponse response{};
+
+		for (const auto connection : getInstanceConnections())
+		{
+			ReadTransaction transaction(*connection);
+
+			const auto defaultGateway = repositories[std::to_underlying(PaymentGateway::DEFAULT)].getPaymentsSummary(
+				transaction, fromInt, toInt);
+			const auto fallbackGateway = repositories[std::to_underlying(PaymentGateway::FALLBACK)].getPaymentsSummary(
+				transaction, fromInt, toInt);
+
+			response.defaultGateway.totalRequests += defaultGateway.totalRequests;
+			response.defaultGateway.totalAmount += defaultGateway.totalAmount;
+			response.fallbackGateway.totalRequests += fallbackGateway.totalRequests;
+			response.fallbackGateway.totalAmount += fallbackGateway.totalAmount;
+		}
 
 		return response;
 	};
 
+	std::optional<PaymentService::PaymentsSummaryResponse> PaymentService::getTotalsPaymentsSummary(
+		std::optional<std::int64_t> from, std::optional<std::int64_t> to)
+	{
+		const auto connections = getInstanceConnections();
+
+		PaymentsSummaryResponse response{};
+
+		if (from && to && *from > *to)
+			return response;
+
+		// Whole seconds come from the totals, and the parts of the seconds at the ends of the range from LMDB
+		std::optional<std::int64_t> fromSecond, toSecond;
+		std::vector<std::pair<std::int64_t, std::int64_t>> partialRanges;
+
+		if (from && to && *from / 1000 == *to / 1000 && (*from % 1000 != 0 || *to % 1000 != 999))
+		{
+			fromSecond = *from / 1000 + 1;
+			toSecond = *from / 1000;
+			partialRanges.emplace_back(*from, *to);
+		}
+		else
+		{
+			if (from)
+			{
+				fromSecond = (*from + 999) / 1000;
+
+				if (*from % 1000 != 0)
+					partialRanges.emplace_back(*from, *fromSecond * 1000 - 1);
+			}
+
+			if (to)
+			{
+				toSecond = (*to + 1) / 1000 - 1;
+
+				if (*to % 1000 != 999)
+					partialRanges.emplace_back((*toSecond + 1) * 1000, *to);
+			}
+		}
+
+		auto& totals = PaymentTotals::get();
+		const auto generation = getActiveGeneration();
+		const auto defaultTotals = totals.getTotals(PaymentGateway::DEFAULT, generation, fromSecond, toSecond);
+		const auto fallbackTotals = totals.getTotals(PaymentGateway::FALLBACK, generation, fromSecond, toSecond);
+
+		if (!defaultTotals || !fallbackTotals)
+			return std::nullopt;
+
+		response.defaultGateway.totalRequests = static_cast<unsigned>(defaultTotals->count);
+		response.defaultGateway.totalAmount = static_cast<double>(defaultTotals->amountInCents) / 100;
+		response.fallbackGateway.totalRequests = static_cast<unsigned>(fallbackTotals->count);
+		response.fallbackGateway.totalAmount = static_cast<double>(fallbackTotals->amountInCents) / 100;
+
+		for (const auto connection : connections)
+		{
+			if (partialRanges.empty())
+				break;
+
+			ReadTransaction transaction(*connection);
+
+			for (const auto& [partialFrom, partialTo] : partialRanges)
+			{
+				const auto defaultGateway = repositories[std::to_underlying(PaymentGateway::DEFAULT)]
+												.getPaymentsSummary(transaction, partialFrom, partialTo);
+				const auto fallbackGateway = repositories[std::to_underlying(PaymentGateway::FALLBACK)]
+												 .getPaymentsSummary(transaction, partialFrom, partialTo);
+
+				response.defaultGateway.totalRequests += defaultGateway.totalRequests;
+				response.defaultGateway.totalAmount += defaultGateway.totalAmount;
+				response.fallbackGateway.totalRequests += fallbackGateway.totalRequests;
+				response.fallbackGateway.totalAmount += fallbackGateway.totalAmount;
+			}
+		}
+
+		return response;
+	}
+
+	PaymentService::PaymentsSummaryResponse PaymentService::getPartitionedPaymentsSummary(
+		std::optional<std::int64_t> from, std::optional<std::int64_t> to)
+	{
+		std::vector<SummaryPartition> partitions;
+
+		for (const auto connection : getInstanceConnections())
+		{
+			ReadTransaction transaction(*connection);
+
+			for (const auto gateway : {PaymentGateway::DEFAULT, PaymentGateway::FALLBACK})
+			{
+				const auto keyRange = repositories[std::to_underlying(gateway)].getKeyRange(transaction);
+
+				if (!keyRange)
+					continue;
+
+				const auto rangeFrom = std::max(from.value_or(keyRange->first), keyRange->first);
+				const auto rangeTo = std::min(to.value_or(keyRange->last), keyRange->last);
+
+				if (rangeFrom > rangeTo)
+					continue;
+
+				// Estimated as if the payments were evenly spread between the first and last ones
+				const auto width = rangeTo - rangeFrom + 1;
+				const auto estimatedRows = static_cast<double>(keyRange->entries) * static_cast<double>(width) /
+					static_cast<double>(keyRange->last - keyRange->first + 1);
+				const auto ways = std::clamp<std::int64_t>(
+					static_cast<std::int64_t>(estimatedRows / std::max(Config::summaryPartitionRows, 1u)), 1,
+					std::min<std::int64_t>(Config::summaryParallelism, width));
+
+				for (std::int64_t i = 0; i < ways; ++i)
+				{
+					partitions.push_back({
+						.connection = connection,
+						.gateway = gateway,
+						.from = rangeFrom + width * i / ways,
+						.to = rangeFrom + width * (i + 1) / ways - 1,
+					});
+				}
+			}
+		}
+
+		PaymentsSummaryResponse response{};
+
+		if (partitions.empty())
+			return response;
+
+		const auto job = std::make_shared<SummaryJob>(std::move(partitions));
+		const auto helpers = std::min<std::size_t>(job->partitions.size(), Config::summaryParallelism) - 1;
+
+		for (std::size_t i = 0; i < helpers; ++i)
+			boost::asio::post(*summaryExecutor, [this, job] { runSummaryPartitions(*job, repositories); });
+
+		runSummaryPartitions(*job, repositories);
+		job->done.wait();
+
+		for (const auto& partition : job->partitions)
+		{
+			if (partition.exception)
+				std::rethrow_exception(partition.exception);
+
+			auto& gatewayResponse =
+				partition.gateway == PaymentGateway::DEFAULT ? response.defaultGateway : response.fallbackGateway;
+			gatewayResponse.totalRequests += partition.result.totalRequests;
+			gatewayResponse.totalAmount += partition.result.totalAmount;
+		}
+
+		return response;
+	}
+
 	void PaymentService::purge()
 	{
-		repositories[std::to_underlying(PaymentGateway::DEFAULT)].purge();
-		repositories[std::to_underlying(PaymentGateway::FALLBACK)].purge();
+		// Concurrent purges would race on the generation switch and on the reclaimer
+		std::unique_lock lock(purgeMutex);
+
+		if (ledger)
+			ledger->purge();
+		else
+		{
+			// The next generation was emptied by the reclaimer of the previous purge, unless it's still running
+			if (reclaimer.joinable())
+				reclaimer.join();
+
+			const auto connections = getInstanceConnections();
+			unsigned previousGeneration;
+
+			for (const auto connection : connections)
+			{
+				Transaction transaction(*connection, 0);
+				const auto nextGeneration = (transaction.generation + 1) % DATABASE_GENERATIONS;
+
+				repositories[std::to_underlying(PaymentGateway::DEFAULT)].purge(transaction, nextGeneration);
+				repositories[std::to_underlying(PaymentGateway::FALLBACK)].purge(transaction, nextGeneration);
+			}
+
+			{  // scope
+				// Writes to this instance database are serialized with the switch, so each one goes either to the
+				// generation being reclaimed or to the new one
+				Transaction transaction(getConnection(), 0);
+				previousGeneration = transaction.generation;
+
+				if (Config::summaryTotals)
+					PaymentTotals::get().reset((previousGeneration + 1) % DATABASE_GENERATIONS);
+
+				switchActiveGeneration();
+			}
+
+			// Payments are deleted in chunks, each in its own write transaction, so writers wait for the LMDB
+			// writer lock at most for a chunk instead of for the whole previous generation
+			reclaimer = std::jthread(
+				[this, connections, previousGeneration](std::stop_token stopToken)
+				{
+					try
+					{
+						for (const auto connection : connections)
+						{
+							for (auto& repository : repositories)
+							{
+								bool more = true;
+
+								while (more && !stopToken.stop_requested())
+								{
+									Transaction transaction(*connection, 0);
+
+									// Made active again by a purge of another instance
+									if (transaction.generation == previousGeneration)
+										return;
+
+									more = repository.purgeChunk(transaction, previousGeneration, RECLAIM_CHUNK_SIZE);
+								}
+							}
+						}
+					}
+					catch (const std::exception& e)
+					{
+						std::println(stderr, "Error reclaiming purged payments: {}", e.what());
+						std::fflush(stderr);
+					}
+				});
+		}
+
+		WriteGenerations::get().bumpAll();
 	}
 }  // namespace rinhaback::api
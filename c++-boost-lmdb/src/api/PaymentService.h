@@ -1,10 +1,19 @@
 #pragma once
 
 #include "./Database.h"
+#include "./PaymentLedger.h"
 #include "./PaymentRepository.h"
 #include "./Util.h"
+#include "./WriteGenerations.h"
+#include <future>
+#include <memory>
+#include <mutex>
 #include <optional>
+#include <thread>
 #include <utility>
+#include <vector>
+#include <cstdint>
+#include "boost/asio/thread_pool.hpp"
 
 
 namespace rinhaback::api
@@ -19,7 +28,7 @@ namespace rinhaback::api
 		};
 
 	public:
-		PaymentService() = default;
+		PaymentService();
 
 		PaymentService(const PaymentService&) = delete;
 		PaymentService& operator=(const PaymentService&) = delete;
@@ -33,8 +42,50 @@ namespace rinhaback::api
 
 		void purge();
 
+		// Pool used by summaries split in partitions with SUMMARY_PARALLELISM
+		void setSummaryExecutor(boost::asio::thread_pool::executor_type executor)
+		{
+			summaryExecutor.emplace(std::move(executor));
+		}
+
+	private:
+		// Summaries of the last requested ranges, valid while the write generations match. A summary being
+		// computed is also here, so concurrent requests for the same range wait for it instead of scanning again.
+		struct CachedSummary final
+		{
+			std::optional<std::int64_t> from;
+			std::optional<std::int64_t> to;
+			WriteGenerations::Values generations;
+			std::shared_future<PaymentsSummaryResponse> summary;
+			std::uint64_t scanId;
+			std::uint64_t lastUsed;
+		};
+
+	private:
+		PaymentsSummaryResponse getCachedPaymentsSummary(
+			std::optional<std::int64_t> from, std::optional<std::int64_t> to);
+		PaymentsSummaryResponse scanPaymentsSummary(std::optional<std::int64_t> from, std::optional<std::int64_t> to);
+		std::optional<PaymentsSummaryResponse> getTotalsPaymentsSummary(
+			std::optional<std::int64_t> from, std::optional<std::int64_t> to);
+		PaymentsSummaryResponse getPartitionedPaymentsSummary(
+			std::optional<std::int64_t> from, std::optional<std::int64_t> to);
+
 	private:
 		PaymentRepository repositories[std::to_underlying(PaymentGateway::SIZE)] = {
 			{PaymentGateway::DEFAULT}, {PaymentGateway::FALLBACK}};
+
+		// Used instead of the repositories with STORAGE_ENGINE=ledger
+		std::unique_ptr<PaymentLedger> ledger;
+
+		std::optional<boost::asio::thread_pool::executor_type> summaryExecutor;
+
+		// Used with SUMMARY_CACHE_SIZE
+		std::mutex summaryCacheMutex;
+		std::vector<CachedSummary> summaryCache;
+		std::uint64_t summaryCacheClock = 0;
+
+		// Empties the databases of the generation left by the last purge
+		std::mutex purgeMutex;
+		std::jthread reclaimer;
 	};
 }  // namespace rinhaback::api
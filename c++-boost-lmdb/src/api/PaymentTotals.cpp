@@ -0,0 +1,123 @@
+#include "./PaymentTotals.h"
+#include "./Config.h"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+
+namespace rinhaback::api
+{
+	PaymentTotals::PaymentTotals()
+		: horizon(std::max<std::size_t>(Config::summaryTotalsHorizon, 1)),
+		  shm(boost::interprocess::open_or_create, SHARED_MEMORY_NAME, boost::interprocess::read_write)
+	{
+		// Fenwick trees are indexed from 1
+		const auto treeSize = (horizon + 1) * sizeof(Node);
+		const auto treesOffset = DATABASE_GENERATIONS * sizeof(TreeSet);
+
+		shm.truncate(static_cast<boost::interprocess::offset_t>(
+			treesOffset + treeSize * DATABASE_GENERATIONS * std::to_underlying(PaymentGateway::SIZE)));
+		region = boost::interprocess::mapped_region(shm, boost::interprocess::read_write);
+
+		const auto base = static_cast<std::byte*>(region.get_address());
+		sets = reinterpret_cast<TreeSet*>(base);
+
+		for (unsigned generation = 0; generation < DATABASE_GENERATIONS; ++generation)
+		{
+			for (unsigned gateway = 0; gateway < std::to_underlying(PaymentGateway::SIZE); ++gateway)
+			{
+				trees[generation][gateway] = reinterpret_cast<Node*>(base + treesOffset +
+					(generation * std::to_underlying(PaymentGateway::SIZE) + gateway) * treeSize);
+			}
+		}
+	}
+
+	void PaymentTotals::add(
+		unsigned generation, PaymentGateway gateway, std::int64_t dateTime, std::int64_t amountInCents)
+	{
+		auto& set = sets[generation];
+		const auto cell = dateTime / 1000 - set.baseSecond.load(std::memory_order_relaxed);
+
+		if (cell < 0 || cell >= static_cast<std::int64_t>(horizon))
+		{
+			set.outOfHorizon[std::to_underlying(gateway)].fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+
+		const auto tree = trees[generation][std::to_underlying(gateway)];
+
+		for (auto i = static_cast<std::size_t>(cell) + 1; i <= horizon; i += i & -i)
+		{
+			tree[i].count.fetch_add(1, std::memory_order_relaxed);
+			tree[i].amountInCents.fetch_add(amountInCents, std::memory_order_relaxed);
+		}
+	}
+
+	std::optional<PaymentTotals::Totals> PaymentTotals::getTotals(PaymentGateway gateway, unsigned generation,
+		std::optional<std::int64_t> fromSecond, std::optional<std::int64_t> toSecond)
+	{
+		const auto& set = sets[generation];
+		const auto tree = trees[generation][std::to_underlying(gateway)];
+
+		const auto baseSecond = set.baseSecond.load(std::memory_order_relaxed);
+		const auto endSecond = baseSecond + static_cast<std::int64_t>(horizon);
+
+		if (set.outOfHorizon[std::to_underlying(gateway)].load(std::memory_order_relaxed) != 0 &&
+			(!fromSecond || *fromSecond < baseSecond || !toSecond || *toSecond >= endSecond))
+		{
+			return std::nullopt;
+		}
+
+		const auto first = std::clamp<std::int64_t>(fromSecond.value_or(baseSecond), baseSecond, endSecond);
+		const auto last = std::clamp<std::int64_t>(toSecond.value_or(endSecond), baseSecond - 1, endSecond - 1);
+
+		if (first > last)
+			return Totals{};
+
+		const auto to = getPrefixTotals(tree, static_cast<std::size_t>(last - baseSecond + 1));
+		const auto from = getPrefixTotals(tree, static_cast<std::size_t>(first - baseSecond));
+
+		return Totals{
+			.count = to.count - from.count,
+			.amountInCents = to.amountInCents - from.amountInCents,
+		};
+	}
+
+	PaymentTotals::Totals PaymentTotals::getPrefixTotals(const Node* tree, std::size_t cells)
+	{
+		Totals totals{};
+
+		for (auto i = cells; i > 0; i -= i & -i)
+		{
+			totals.count += tree[i].count.load(std::memory_order_relaxed);
+			totals.amountInCents += tree[i].amountInCents.load(std::memory_order_relaxed);
+		}
+
+		return totals;
+	}
+
+	void PaymentTotals::reset(unsigned generation)
+	{
+		auto& set = sets[generation];
+
+		// Payments written to this generation before the purge that made it inactive
+		while (set.writers.load() != 0)
+			std::this_thread::yield();
+
+		for (const auto tree : trees[generation])
+		{
+			for (std::size_t i = 0; i <= horizon; ++i)
+			{
+				tree[i].count.store(0, std::memory_order_relaxed);
+				tree[i].amountInCents.store(0, std::memory_order_relaxed);
+			}
+		}
+
+		for (auto& outOfHorizon : set.outOfHorizon)
+			outOfHorizon.store(0, std::memory_order_relaxed);
+
+		const auto now =
+			std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch());
+		set.baseSecond.store(now.count() - BASE_SLACK_SECONDS, std::memory_order_release);
+	}
+}  // namespace rinhaback::api
@@ -0,0 +1,117 @@
+#pragma once
+
+#include "./Database.h"
+#include <atomic>
+#include <optional>
+#include <utility>
+#include <cstddef>
+#include <cstdint>
+#include "boost/interprocess/mapped_region.hpp"
+#include "boost/interprocess/shared_memory_object.hpp"
+
+
+namespace rinhaback::api
+{
+	// Count and amount of the payments of each second, kept by all API instances in shared memory as a Fenwick tree
+	// per gateway, so the totals of a range of seconds are read in O(log n) without touching LMDB. The tree covers
+	// SUMMARY_TOTALS_HORIZON seconds starting shortly before the last reset; payments out of it are only counted,
+	// and while there are any, ranges not inside the covered seconds can't be answered.
+	//
+	// There is a set of trees per database generation, and payments are added to the set of the generation they
+	// were written to, so the totals of the active generation always match its databases. A purge resets the set
+	// of the next generation before making it active, after the late writers of that set are done.
+	class PaymentTotals final
+	{
+	public:
+		struct Totals final
+		{
+			std::int64_t count;
+			std::int64_t amountInCents;
+		};
+
+	private:
+		static constexpr const char* SHARED_MEMORY_NAME = "rinhaback25-boost-lmdb-PaymentTotals";
+
+		// Seconds before the reset covered by the tree, for payments requested before it and stored after it
+		static constexpr std::int64_t BASE_SLACK_SECONDS = 60;
+
+		struct alignas(64) TreeSet final
+		{
+			std::atomic_uint32_t writers;
+			std::atomic_int64_t baseSecond;
+			std::atomic_uint64_t outOfHorizon[std::to_underlying(PaymentGateway::SIZE)];
+		};
+
+		struct Node final
+		{
+			std::atomic_int64_t count;
+			std::atomic_int64_t amountInCents;
+		};
+
+	private:
+		PaymentTotals();
+
+	public:
+		PaymentTotals(const PaymentTotals&) = delete;
+		PaymentTotals& operator=(const PaymentTotals&) = delete;
+
+	public:
+		static PaymentTotals& get()
+		{
+			static PaymentTotals paymentTotals;
+			return paymentTotals;
+		}
+
+	public:
+		// Registered inside the write transaction of a payment, before its commit, so the totals of its generation
+		// can't be reset by a later purge before the payment is added to them
+		class Writer final
+		{
+		public:
+			Writer(PaymentTotals& totals, unsigned generation)
+				: totals(totals),
+				  generation(generation)
+			{
+				totals.sets[generation].writers.fetch_add(1);
+			}
+
+			~Writer()
+			{
+				totals.sets[generation].writers.fetch_sub(1);
+			}
+
+			Writer(const Writer&) = delete;
+			Writer& operator=(const Writer&) = delete;
+
+		public:
+			void add(PaymentGateway gateway, std::int64_t dateTime, std::int64_t amountInCents)
+			{
+				totals.add(generation, gateway, dateTime, amountInCents);
+			}
+
+		private:
+			PaymentTotals& totals;
+			const unsigned generation;
+		};
+
+	public:
+		// Totals of the seconds from fromSecond to toSecond, both inclusive and unbounded when not given
+		std::optional<Totals> getTotals(PaymentGateway gateway, unsigned generation,
+			std::optional<std::int64_t> fromSecond, std::optional<std::int64_t> toSecond);
+
+		// Purges call it before the generation becomes active, inside the transaction that switches to it
+		void reset(unsigned generation);
+
+	private:
+		void add(unsigned generation, PaymentGateway gateway, std::int64_t dateTime, std::int64_t amountInCents);
+
+		static Totals getPrefixTotals(const Node* tree, std::size_t cells);
+
+	private:
+		std::size_t horizon;
+		boost::interprocess::shared_memory_object shm;
+		boost::interprocess::mapped_region region;
+		TreeSet* sets;
+		Node* trees[DATABASE_GENERATIONS][std::to_underlying(PaymentGateway::SIZE)];
+	};
+}  // namespace rinhaback::api
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "./SignalHandling.h"
+#include <atomic>
 #include <chrono>
 #include <condition_variable>
 #include <mutex>
@@ -22,7 +23,12 @@ namespace rinhaback::api
 		};
 
 	public:
-		PendingPaymentsQueue() = default;
+		// The queue depth is kept in publishedSize, so it can be read without locking
+		explicit PendingPaymentsQueue(std::atomic_uint32_t& publishedSize)
+			: publishedSize(publishedSize)
+		{
+			publishedSize.store(0, std::memory_order_relaxed);
+		}
 
 		PendingPaymentsQueue(const PendingPaymentsQueue&) = delete;
 		PendingPaymentsQueue& operator=(const PendingPaymentsQueue&) = delete;
@@ -33,6 +39,7 @@ namespace rinhaback::api
 			{  // scope
 				std::unique_lock lock(mutex);
 				queue.push(payment);
+				publishSize();
 			}
 
 			condVar.notify_one();
@@ -56,6 +63,7 @@ namespace rinhaback::api
 
 				Payment payment = queue.front();
 				queue.pop();
+				publishSize();
 
 				return payment;
 			} while (true);
@@ -63,13 +71,27 @@ namespace rinhaback::api
 
 		void purge()
 		{
-			std::unique_lock lock(mutex);
-			queue = {};
+			std::queue<Payment> purged;
+
+			{  // scope
+				std::unique_lock lock(mutex);
+				queue.swap(purged);
+				publishSize();
+			}
+
+			// Freed without holding the lock
+		}
+
+	private:
+		void publishSize()
+		{
+			publishedSize.store(static_cast<uint32_t>(queue.size()), std::memory_order_relaxed);
 		}
 
 	private:
 		std::mutex mutex;
 		std::condition_variable condVar;
 		std::queue<Payment> queue;
+		std::atomic_uint32_t& publishedSize;
 	};
 }  // namespace rinhaback::api
@@ -5,6 +5,8 @@
 #include <string>
 #include <utility>
 #include <cstdint>
+#include <pthread.h>
+#include <sched.h>
 
 
 namespace rinhaback::api
@@ -46,4 +48,27 @@ namespace rinhaback::api
 
 		return {host, port};
 	}
+
+	// Pins the calling thread to the index-th CPU (modulo) of the ones the process is allowed to run on
+	inline void pinCurrentThreadToCpu(unsigned index)
+	{
+		cpu_set_t allowed;
+
+		if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0)
+			return;
+
+		auto remaining = index % static_cast<unsigned>(CPU_COUNT(&allowed));
+
+		for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+		{
+			if (CPU_ISSET(cpu, &allowed) && remaining-- == 0)
+			{
+				cpu_set_t cpuSet;
+				CPU_ZERO(&cpuSet);
+				CPU_SET(cpu, &cpuSet);
+				pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet);
+				return;
+			}
+		}
+	}
 }  // namespace rinhaback::api
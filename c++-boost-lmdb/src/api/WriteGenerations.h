@@ -0,0 +1,76 @@
+#pragma once
+
+#include "./Database.h"
+#include <array>
+#include <atomic>
+#include <utility>
+#include <cstdint>
+#include "boost/interprocess/mapped_region.hpp"
+#include "boost/interprocess/shared_memory_object.hpp"
+
+
+namespace rinhaback::api
+{
+	// Counters of the writes done by all API instances to each gateway, published in shared memory so cached
+	// summaries can be validated by comparing them. A counter is bumped after the write is visible, so a summary
+	// tagged with the counters read before its scan is never newer than its tag says.
+	class WriteGenerations final
+	{
+	public:
+		using Values = std::array<std::uint64_t, std::to_underlying(PaymentGateway::SIZE)>;
+
+	private:
+		static constexpr const char* SHARED_MEMORY_NAME = "rinhaback25-boost-lmdb-WriteGenerations";
+
+		struct alignas(64) Generation final
+		{
+			std::atomic_uint64_t value;
+		};
+
+	private:
+		WriteGenerations()
+			: shm(boost::interprocess::open_or_create, SHARED_MEMORY_NAME, boost::interprocess::read_write)
+		{
+			shm.truncate(sizeof(Generation) * std::to_underlying(PaymentGateway::SIZE));
+			region = boost::interprocess::mapped_region(shm, boost::interprocess::read_write);
+			generations = static_cast<Generation*>(region.get_address());
+		}
+
+	public:
+		WriteGenerations(const WriteGenerations&) = delete;
+		WriteGenerations& operator=(const WriteGenerations&) = delete;
+
+	public:
+		static WriteGenerations& get()
+		{
+			static WriteGenerations writeGenerations;
+			return writeGenerations;
+		}
+
+		void bump(PaymentGateway gateway)
+		{
+			generations[std::to_underlying(gateway)].value.fetch_add(1, std::memory_order_release);
+		}
+
+		void bumpAll()
+		{
+			for (unsigned i = 0; i < std::to_underlying(PaymentGateway::SIZE); ++i)
+				generations[i].value.fetch_add(1, std::memory_order_release);
+		}
+
+		Values load() const
+		{
+			Values values;
+
+			for (unsigned i = 0; i < std::to_underlying(PaymentGateway::SIZE); ++i)
+				values[i] = generations[i].value.load(std::memory_order_acquire);
+
+			return values;
+		}
+
+	private:
+		boost::interprocess::shared_memory_object shm;
+		boost::interprocess::mapped_region region;
+		Generation* generations;
+	};
+}  // namespace rinhaback::api
@@ -1,17 +1,27 @@
 #include "mimalloc-new-delete.h"
 #include "./PaymentProcessor.h"
 #include "./Config.h"
+#include "./FastHttpRequest.h"
 #include "./GatewayChooserService.h"
+#include "./PaymentRequestParser.h"
 #include "./PaymentService.h"
 #include "./PendingPaymentsQueue.h"
 #include "./SignalHandling.h"
 #include "./Util.h"
+#include "../common/LoadStats.h"
+#include <array>
+#include <filesystem>
 #include <format>
+#include <iterator>
 #include <memory>
 #include <optional>
 #include <print>
+#include <stdexcept>
 #include <string>
+#include <string_view>
 #include <thread>
+#include <type_traits>
+#include <vector>
 #include "boost/asio.hpp"
 #include "boost/beast.hpp"
 #include "boost/json.hpp"
@@ -21,18 +31,34 @@
 namespace asio = boost::asio;
 namespace beast = boost::beast;
 namespace http = boost::beast::http;
+namespace stdfs = std::filesystem;
 using tcp = asio::ip::tcp;
+using reuse_port = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
 
 
 namespace
 {
+	using namespace rinhaback;
 	using namespace rinhaback::api;
 
 	std::shared_ptr<PaymentService> paymentService{std::make_shared<PaymentService>()};
-	std::shared_ptr<PendingPaymentsQueue> pendingPaymentsQueue{std::make_shared<PendingPaymentsQueue>()};
-	std::unique_ptr<asio::io_context> ioc;
+	std::shared_ptr<PendingPaymentsQueue> pendingPaymentsQueue;
+	std::vector<std::unique_ptr<asio::io_context>> iocs;
 	std::unique_ptr<asio::thread_pool> workerPool;
 
+	template <typename OutputIt>
+	OutputIt formatPaymentsSummary(OutputIt out, const PaymentService::PaymentsSummaryResponse& summary)
+	{
+		const auto& defaultGateway = summary.defaultGateway;
+		const auto& fallbackGateway = summary.fallbackGateway;
+
+		return std::format_to(out,
+			R"({{"default":{{"totalRequests":{},"totalAmount":{:.2f}}},)"
+			R"("fallback":{{"totalRequests":{},"totalAmount":{:.2f}}}}})",
+			defaultGateway.totalRequests, defaultGateway.totalAmount, fallbackGateway.totalRequests,
+			fallbackGateway.totalAmount);
+	}
+
 	// Handler for GET /payments-summary
 	void paymentsSummaryHandler(const boost::urls::url_view& url, http::response<http::string_body>& res)
 	{
@@ -46,22 +72,29 @@ namespace
 		if (const auto toParam = urlParams.find("to"); toParam != urlParams.end())
 			to = parseDateTime((*toParam).value);
 
-		const auto summary = paymentService->getPaymentsSummary(from, to);
-
-		const auto& defaultGateway = summary.defaultGateway;
-		const auto& fallbackGateway = summary.fallbackGateway;
-
-		res.body() = std::format(R"({{"default":{{"totalRequests":{},"totalAmount":{:.2f}}},)"
-								 R"("fallback":{{"totalRequests":{},"totalAmount":{:.2f}}}}})",
-			defaultGateway.totalRequests, defaultGateway.totalAmount, fallbackGateway.totalRequests,
-			fallbackGateway.totalAmount);
+		formatPaymentsSummary(std::back_inserter(res.body()), paymentService->getPaymentsSummary(from, to));
 		res.result(http::status::ok);
 	}
 
 	// Handler for POST /payments
-	void postPaymentHandler(const boost::urls::url_view& url, http::request<http::string_body>& req)
+	void postPaymentHandler(std::string_view body)
 	{
-		auto inJsonObj = boost::json::parse(req.body()).as_object();
+		PendingPaymentsQueue::Payment parsedPayment;
+
+		switch (PaymentRequestParser::parse(body, parsedPayment))
+		{
+			case PaymentRequestParser::Result::OK:
+				pendingPaymentsQueue->enqueue(parsedPayment);
+				return;
+
+			case PaymentRequestParser::Result::INVALID:
+				return;
+
+			case PaymentRequestParser::Result::FALLBACK:
+				break;
+		}
+
+		auto inJsonObj = boost::json::parse(body).as_object();
 		const auto& correlationIdJson = inJsonObj["correlationId"];
 		const auto amountJson = inJsonObj["amount"];
 
@@ -90,16 +123,17 @@ namespace
 		res.result(http::status::ok);
 	}
 
-	asio::awaitable<void> sessionHandler(tcp::socket socket)
+	// Serves requests that FastHttpRequest does not support, starting from the bytes already read
+	template <typename Stream>
+	asio::awaitable<void> beastSessionHandler(Stream& stream, std::string_view received)
 	{
-		auto stream = std::make_shared<beast::tcp_stream>(std::move(socket));
-		stream->expires_after(std::chrono::seconds(30));
+		beast::flat_buffer buffer;
+		buffer.commit(asio::buffer_copy(buffer.prepare(received.size()), asio::buffer(received)));
 
-		auto buffer = std::make_shared<beast::flat_buffer>();
-		auto req = std::make_shared<http::request<http::string_body>>();
+		http::request<http::string_body> req;
 
 		boost::system::error_code ec;
-		co_await http::async_read(*stream, *buffer, *req, asio::redirect_error(asio::use_awaitable, ec));
+		co_await http::async_read(stream, buffer, req, asio::redirect_error(asio::use_awaitable, ec));
 
 		if (ec)
 		{
@@ -108,12 +142,12 @@ namespace
 			co_return;
 		}
 
-		auto res = std::make_shared<http::response<http::string_body>>(http::status::not_found, req->version());
-		res->keep_alive(req->keep_alive());
+		http::response<http::string_body> res(http::status::not_found, req.version());
+		res.keep_alive(req.keep_alive());
 
 		try
 		{
-			const auto url = boost::urls::parse_origin_form(req->target()).value();
+			const auto url = boost::urls::parse_origin_form(req.target()).value();
 			enum
 			{
 				HANDLER_PAYMENTS_SUMMARY,
@@ -122,7 +156,7 @@ namespace
 				HANDLER_ERROR
 			} handler = HANDLER_ERROR;
 
-			switch (req->method())
+			switch (req.method())
 			{
 				case http::verb::get:
 					if (url.path() == "/payments-summary")
@@ -140,68 +174,183 @@ namespace
 					break;
 			}
 
-			if (handler == HANDLER_POST_PAYMENT)
+			// Cheap handlers run inline on the IO thread. Only the summary scan is moved to the worker pool,
+			// and the session resumes here on its own executor when it completes.
+			switch (handler)
 			{
-				res->result(http::status::ok);
+				case HANDLER_PAYMENTS_SUMMARY:
+					co_await asio::co_spawn(
+						*workerPool,
+						[&]() -> asio::awaitable<void>
+						{
+							paymentsSummaryHandler(url, res);
+							co_return;
+						},
+						asio::use_awaitable);
+					break;
 
-				co_await http::async_write(*stream, *res, asio::redirect_error(asio::use_awaitable, ec));
+				case HANDLER_POST_PAYMENT:
+					res.result(http::status::ok);
+					break;
+
+				case HANDLER_PURGE_PAYMENTS:
+					purgePaymentsHandler(res);
+					break;
 
-				boost::system::error_code shutdownEc;
-				stream->socket().shutdown(tcp::socket::shutdown_send, shutdownEc);
+				default:
+					break;
 			}
 
-			asio::post(*workerPool,
-				[url, req, res, stream, handler]()
-				{
-					switch (handler)
+			res.prepare_payload();
+
+			co_await http::async_write(stream, res, asio::redirect_error(asio::use_awaitable, ec));
+
+			boost::system::error_code shutdownEc;
+			stream.socket().shutdown(asio::socket_base::shutdown_send, shutdownEc);
+
+			if (handler == HANDLER_POST_PAYMENT)
+				postPaymentHandler(req.body());
+		}
+		catch (const std::exception& e)
+		{
+			std::println(stderr, "Error handling request: {}", e.what());
+			std::fflush(stderr);
+		}
+	}
+
+	template <typename Stream>
+	asio::awaitable<void> fastSessionHandler(Stream& stream, const FastHttpRequest& request)
+	{
+		// Large enough for the summary body with any finite amounts
+		std::array<char, 1024> summaryBody;
+		std::array<char, 64> summaryHeader;
+		std::array<asio::const_buffer, 2> response = {asio::buffer(HTTP_RESPONSE_NOT_FOUND)};
+		bool postPayment = false;
+
+		try
+		{
+			switch (request.method)
+			{
+				case FastHttpRequest::Method::GET:
+					if (request.path == "/payments-summary")
 					{
-						case HANDLER_PAYMENTS_SUMMARY:
-							paymentsSummaryHandler(url, *res);
-							break;
+						std::optional<DateTimeMillis> from, to;
+
+						if (const auto fromParam = request.getQueryParam("from"))
+							from = parseDateTime(*fromParam);
 
-						case HANDLER_POST_PAYMENT:
-							postPaymentHandler(url, *req);
-							break;
+						if (const auto toParam = request.getQueryParam("to"))
+							to = parseDateTime(*toParam);
 
-						case HANDLER_PURGE_PAYMENTS:
-							purgePaymentsHandler(*res);
-							break;
+						PaymentService::PaymentsSummaryResponse summary;
 
-						default:
-							break;
+						co_await asio::co_spawn(
+							*workerPool,
+							[&]() -> asio::awaitable<void>
+							{
+								summary = paymentService->getPaymentsSummary(from, to);
+								co_return;
+							},
+							asio::use_awaitable);
+
+						const auto bodyEnd = formatPaymentsSummary(summaryBody.data(), summary);
+						const auto bodySize = static_cast<std::size_t>(bodyEnd - summaryBody.data());
+						const auto headerEnd = std::format_to(summaryHeader.data(),
+							"HTTP/1.1 200 OK\r\nContent-Length: {}\r\n\r\n", bodySize);
+
+						response = {asio::buffer(summaryHeader.data(), headerEnd - summaryHeader.data()),
+							asio::buffer(summaryBody.data(), bodySize)};
 					}
+					break;
 
-					if (handler != HANDLER_POST_PAYMENT)
+				case FastHttpRequest::Method::POST:
+					if (request.path == "/payments")
+					{
+						response = {asio::buffer(HTTP_RESPONSE_OK)};
+						postPayment = true;
+					}
+					else if (request.path == "/purge-payments")
 					{
-						res->prepare_payload();
+						paymentService->purge();
+						pendingPaymentsQueue->purge();
 
-						asio::post(stream->get_executor(),
-							[stream, res]()
-							{
-								asio::co_spawn(
-									stream->get_executor(),
-									[stream, res]() -> asio::awaitable<void>
-									{
-										boost::system::error_code ec;
-										co_await http::async_write(
-											*stream, *res, asio::redirect_error(asio::use_awaitable, ec));
-
-										boost::system::error_code shutdownEc;
-										stream->socket().shutdown(tcp::socket::shutdown_send, shutdownEc);
-									},
-									asio::detached);
-							});
+						response = {asio::buffer(HTTP_RESPONSE_OK)};
 					}
-				});
+					break;
+			}
+		}
+		catch (const std::invalid_argument& e)
+		{
+			// Malformed query parameters
+			std::println(stderr, "Invalid request: {}", e.what());
+			std::fflush(stderr);
+
+			response = {asio::buffer(HTTP_RESPONSE_BAD_REQUEST)};
+		}
+		catch (const std::exception& e)
+		{
+			std::println(stderr, "Error handling request: {}", e.what());
+			std::fflush(stderr);
+
+			response = {asio::buffer(HTTP_RESPONSE_INTERNAL_SERVER_ERROR)};
+		}
+
+		boost::system::error_code ec;
+		co_await asio::async_write(stream, response, asio::redirect_error(asio::use_awaitable, ec));
+
+		boost::system::error_code shutdownEc;
+		stream.socket().shutdown(asio::socket_base::shutdown_send, shutdownEc);
+
+		try
+		{
+			if (postPayment)
+				postPaymentHandler(request.body);
 		}
 		catch (const std::exception& e)
 		{
-			std::println(stderr, "Error handling request: {}", ec.message());
+			std::println(stderr, "Error handling request: {}", e.what());
 			std::fflush(stderr);
 		}
 	}
 
-	asio::awaitable<void> accept(tcp::acceptor& acceptor)
+	// Requests are read into a buffer in the session frame and tokenized in place. The routes are answered with
+	// pre-serialized responses, and anything FastHttpRequest does not support is handed to Beast.
+	template <typename Protocol>
+	asio::awaitable<void> sessionHandler(typename Protocol::socket socket)
+	{
+		beast::basic_stream<Protocol> stream(std::move(socket));
+		stream.expires_after(std::chrono::seconds(30));
+
+		std::array<char, FastHttpRequest::MAX_SIZE * 2> buffer;
+		std::size_t bufferSize = 0;
+		FastHttpRequest request;
+		auto parseResult = FastHttpRequest::ParseResult::INCOMPLETE;
+
+		while (parseResult == FastHttpRequest::ParseResult::INCOMPLETE && bufferSize < buffer.size())
+		{
+			boost::system::error_code ec;
+			bufferSize += co_await stream.async_read_some(
+				asio::buffer(buffer.data() + bufferSize, buffer.size() - bufferSize),
+				asio::redirect_error(asio::use_awaitable, ec));
+
+			if (ec)
+			{
+				std::println(stderr, "Read error: {}", ec.message());
+				std::fflush(stderr);
+				co_return;
+			}
+
+			parseResult = request.parse(std::string_view(buffer.data(), bufferSize));
+		}
+
+		if (parseResult == FastHttpRequest::ParseResult::COMPLETE)
+			co_await fastSessionHandler(stream, request);
+		else
+			co_await beastSessionHandler(stream, std::string_view(buffer.data(), bufferSize));
+	}
+
+	template <typename Protocol>
+	asio::awaitable<void> accept(typename Protocol::acceptor& acceptor)
 	{
 		while (true)
 		{
@@ -219,16 +368,10 @@ namespace
 				break;
 			}
 
-			socket.set_option(boost::asio::ip::tcp::no_delay(true));
+			if constexpr (std::is_same_v<Protocol, tcp>)
+				socket.set_option(boost::asio::ip::tcp::no_delay(true));
 
-			asio::co_spawn(
-				acceptor.get_executor(),
-				[socketPtr = std::make_shared<tcp::socket>(std::move(socket))]() -> asio::awaitable<void>
-				{
-					//
-					co_await sessionHandler(std::move(*socketPtr));
-				},
-				asio::detached);
+			asio::co_spawn(acceptor.get_executor(), sessionHandler<Protocol>(std::move(socket)), asio::detached);
 		}
 	}
 
@@ -237,38 +380,93 @@ namespace
 		const auto [ip, port] = parseHostPort(Config::listenAddress, 8080);
 		const auto endpoint = tcp::endpoint{boost::asio::ip::make_address(ip), port};
 
-		tcp::acceptor acceptor(*ioc, endpoint);
+		tcp::acceptor acceptor(co_await asio::this_coro::executor);
+		acceptor.open(endpoint.protocol());
 		acceptor.set_option(asio::socket_base::reuse_address(true));
+
+		// Each per-thread io_context has its own acceptor and the kernel shards connections among them
+		if (Config::ioContextPerThread)
+			acceptor.set_option(reuse_port(true));
+
+		acceptor.bind(endpoint);
+		acceptor.listen();
 		acceptor.set_option(boost::asio::ip::tcp::no_delay(true));
 
 		std::println("Server listening on {}", Config::listenAddress);
 		std::fflush(stdout);
 
-		co_await accept(acceptor);
+		co_await accept<tcp>(acceptor);
+	}
+
+	asio::awaitable<void> runUnixServer()
+	{
+		const asio::local::stream_protocol::endpoint endpoint{Config::listenUnixPath};
+
+		stdfs::remove(Config::listenUnixPath);
+
+		asio::local::stream_protocol::acceptor acceptor(co_await asio::this_coro::executor, endpoint);
+		stdfs::permissions(Config::listenUnixPath,
+			stdfs::perms::owner_read | stdfs::perms::owner_write | stdfs::perms::group_read |
+				stdfs::perms::group_write | stdfs::perms::others_read | stdfs::perms::others_write);
+
+		std::println("Server listening on unix:{}", Config::listenUnixPath);
+		std::fflush(stdout);
+
+		co_await accept<asio::local::stream_protocol>(acceptor);
+	}
+
+	void runIoContext(unsigned index)
+	{
+		if (Config::ioPinThreads)
+			pinCurrentThreadToCpu(index);
+
+		iocs[Config::ioContextPerThread ? index : 0]->run();
 	}
 
 	void run()
 	{
-		ioc = std::make_unique<asio::io_context>(Config::ioWorkers);
+		// Not at namespace scope, so an invalid INSTANCE_ID is reported by main like any other startup error
+		auto& instanceLoad = LoadStats::get().getInstance(Config::instanceId);
+
+		// Payments in flight when a previous run of this instance stopped
+		instanceLoad.inFlightPayments.store(0, std::memory_order_relaxed);
+
+		pendingPaymentsQueue = std::make_shared<PendingPaymentsQueue>(instanceLoad.pendingPayments);
+
+		const unsigned iocCount = Config::ioContextPerThread ? Config::ioWorkers : 1;
+
+		for (unsigned i = 0; i < iocCount; ++i)
+			iocs.push_back(std::make_unique<asio::io_context>(Config::ioContextPerThread ? 1 : Config::ioWorkers));
 
 		workerPool = std::make_unique<asio::thread_pool>(Config::handlerWorkers);
+		paymentService->setSummaryExecutor(workerPool->get_executor());
+
+		for (auto& ioc : iocs)
+			asio::co_spawn(*ioc, runServer, asio::detached);
+
+		// Unix sockets have no SO_REUSEPORT sharding, so there is a single acceptor
+		if (!Config::listenUnixPath.empty())
+			asio::co_spawn(*iocs.front(), runUnixServer, asio::detached);
 
-		asio::co_spawn(*ioc, runServer, asio::detached);
+		// Per-thread io_contexts are run by a single thread each, so the processor gets its own one
+		asio::io_context processorIoc{1};
 
 		std::vector<std::jthread> threads;
-		threads.reserve(1 + Config::ioWorkers);
+		threads.reserve(2 + Config::ioWorkers);
 
 		if (Config::coordinator)
 			threads.emplace_back(GatewayChooserService::start());
 
-		threads.emplace_back(PaymentProcessor::start(*ioc, pendingPaymentsQueue, paymentService));
+		threads.emplace_back(PaymentProcessor::start(
+			Config::ioContextPerThread ? processorIoc : *iocs.front(), pendingPaymentsQueue, paymentService));
 
-		getConnection();
+		if (!Config::ledgerStorage)
+			getConnection();
 
 		for (unsigned i = 1; i < Config::ioWorkers; ++i)
-			threads.emplace_back([] { ioc->run(); });
+			threads.emplace_back([i] { runIoContext(i); });
 
-		ioc->run();
+		runIoContext(0);
 
 		threads.clear();
 		workerPool->stop();
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <atomic>
+#include <format>
+#include <stdexcept>
+#include <cstdint>
+#include "boost/interprocess/mapped_region.hpp"
+#include "boost/interprocess/shared_memory_object.hpp"
+
+
+namespace rinhaback
+{
+	// Load of each API instance, published in shared memory so the proxy can route payments to the least loaded
+	// one. The segment starts zero-filled, so whichever process comes first creates it.
+	class LoadStats final
+	{
+	public:
+		static constexpr unsigned MAX_INSTANCES = 8;
+
+		struct alignas(64) InstanceLoad final
+		{
+			std::atomic_uint32_t pendingPayments;
+			std::atomic_uint32_t inFlightPayments;
+
+			uint32_t getLoad() const
+			{
+				return pendingPayments.load(std::memory_order_relaxed) +
+					inFlightPayments.load(std::memory_order_relaxed);
+			}
+		};
+
+	private:
+		static constexpr const char* SHARED_MEMORY_NAME = "rinhaback25-boost-lmdb-LoadStats";
+
+	private:
+		LoadStats()
+			: shm(boost::interprocess::open_or_create, SHARED_MEMORY_NAME, boost::interprocess::read_write)
+		{
+			shm.truncate(sizeof(InstanceLoad) * MAX_INSTANCES);
+			region = boost::interprocess::mapped_region(shm, boost::interprocess::read_write);
+			instances = static_cast<InstanceLoad*>(region.get_address());
+		}
+
+	public:
+		LoadStats(const LoadStats&) = delete;
+		LoadStats& operator=(const LoadStats&) = delete;
+
+	public:
+		static LoadStats& get()
+		{
+			static LoadStats loadStats;
+			return loadStats;
+		}
+
+		InstanceLoad& getInstance(unsigned instanceId)
+		{
+			if (instanceId >= MAX_INSTANCES)
+			{
+				throw std::out_of_range(
+					std::format("Instance id {} is out of the {} supported instances", instanceId, MAX_INSTANCES));
+			}
+
+			return instances[instanceId];
+		}
+
+	private:
+		boost::interprocess::shared_memory_object shm;
+		boost::interprocess::mapped_region region;
+		InstanceLoad* instances;
+	};
+
+	// Counts a payment as in flight for its lifetime, so exceptions from processing it don't leak the count
+	class InFlightPaymentGuard final
+	{
+	public:
+		explicit InFlightPaymentGuard(LoadStats::InstanceLoad& instanceLoad)
+			: inFlightPayments(instanceLoad.inFlightPayments)
+		{
+			inFlightPayments.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		~InFlightPaymentGuard()
+		{
+			inFlightPayments.fetch_sub(1, std::memory_order_relaxed);
+		}
+
+		InFlightPaymentGuard(const InFlightPaymentGuard&) = delete;
+		InFlightPaymentGuard& operator=(const InFlightPaymentGuard&) = delete;
+
+	private:
+		std::atomic_uint32_t& inFlightPayments;
+	};
+}  // namespace rinhaback
@@ -20,8 +20,11 @@ namespace rinhaback::proxy
 
 	public:
 		static inline const auto ioWorkers = static_cast<unsigned>(std::stoul(readEnv("IO_WORKERS", "8")));
+		static inline const auto ioContextPerThread = readEnv("IO_CONTEXT_PER_THREAD", "false") == "true";
+		static inline const auto ioPinThreads = readEnv("IO_PIN_THREADS", "false") == "true";
 		static inline const auto listenAddress = readEnv("LISTEN_ADDRESS", "0.0.0.0:9999");
 		static inline const auto backend0Address = readEnv("BACKEND_0_ADDRESS", "localhost:8001");
 		static inline const auto backend1Address = readEnv("BACKEND_1_ADDRESS", "localhost:8002");
+		static inline const auto balanceByLoad = readEnv("BALANCE_BY_LOAD", "false") == "true";
 	};
 }  // namespace rinhaback::proxy
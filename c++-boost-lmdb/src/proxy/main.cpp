@@ -1,12 +1,14 @@
 #include "mimalloc-new-delete.h"
 #include "./Config.h"
 #include "./Util.h"
+#include "../common/LoadStats.h"
 #include <array>
 #include <atomic>
 #include <chrono>
 #include <memory>
 #include <print>
 #include <string>
+#include <string_view>
 #include <thread>
 #include <vector>
 #include "boost/asio.hpp"
@@ -17,24 +19,55 @@ namespace asio = boost::asio;
 namespace beast = boost::beast;
 namespace http = boost::beast::http;
 using tcp = asio::ip::tcp;
+using reuse_port = asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>;
 
 
 namespace
 {
+	using namespace rinhaback;
 	using namespace rinhaback::proxy;
 
 	struct Backend final
 	{
 		std::string address;
-		tcp::endpoint endpoint;
+		asio::generic::stream_protocol::endpoint endpoint;
 	};
 
+	constexpr std::string_view UNIX_ADDRESS_PREFIX = "unix:";
+
 	constexpr bool ASYNC_POST_PAYMENT = true;
 	constexpr std::chrono::seconds connectionTimeout{30};
-	std::unique_ptr<asio::io_context> ioc;
+	std::vector<std::unique_ptr<asio::io_context>> iocs;
 	std::array<Backend, 2> backends;
 	std::atomic<size_t> nextBackend{0};
 
+	// Payments go to the API instance with the smallest backlog, backend N being the instance with INSTANCE_ID N.
+	// Ties and other requests are balanced round robin.
+	const Backend& chooseBackend(bool payment)
+	{
+		const size_t first = nextBackend.fetch_add(1) % backends.size();
+
+		if (!payment || !Config::balanceByLoad)
+			return backends[first];
+
+		auto& loadStats = LoadStats::get();
+		size_t best = first;
+		auto bestLoad = loadStats.getInstance(first).getLoad();
+
+		for (size_t i = 1; i < backends.size(); ++i)
+		{
+			const auto index = (first + i) % backends.size();
+
+			if (const auto load = loadStats.getInstance(index).getLoad(); load < bestLoad)
+			{
+				best = index;
+				bestLoad = load;
+			}
+		}
+
+		return backends[best];
+	}
+
 	class Session final : public std::enable_shared_from_this<Session>
 	{
 	private:
@@ -47,7 +80,7 @@ namespace
 	public:
 		explicit Session(tcp::socket socket)
 			: frontendStream(std::move(socket)),
-			  backendStream(*ioc)
+			  backendStream(frontendStream.get_executor())
 		{
 			frontendStream.expires_after(connectionTimeout);
 		}
@@ -123,8 +156,7 @@ namespace
 
 		asio::awaitable<void> proxyToBackend()
 		{
-			size_t backendIndex = nextBackend.fetch_add(1) % backends.size();
-			const auto& backend = backends[backendIndex];
+			const auto& backend = chooseBackend(handlerType == HandlerType::ASYNC);
 
 			backendStream.expires_after(connectionTimeout);
 
@@ -133,8 +165,7 @@ namespace
 
 			if (ec)
 			{
-				std::println(stderr, "Backend connect error ({}:{}): {}", backend.endpoint.address().to_string(),
-					backend.endpoint.port(), ec.message());
+				std::println(stderr, "Backend connect error ({}): {}", backend.address, ec.message());
 				std::fflush(stderr);
 				co_await sendErrorResponse(http::status::bad_gateway);
 				co_return;
@@ -225,22 +256,61 @@ namespace
 	private:
 		HandlerType handlerType = HandlerType::PROXY;
 		beast::tcp_stream frontendStream;
-		beast::tcp_stream backendStream;
+		beast::basic_stream<asio::generic::stream_protocol> backendStream;
 		beast::flat_buffer buffer;
 		http::request<http::string_body> request;
 		http::response<http::string_body> response;
 	};
 
+	void resolveBackends()
+	{
+		asio::io_context ioc;
+		tcp::resolver resolver{ioc};
+
+		backends[0].address = Config::backend0Address;
+		backends[1].address = Config::backend1Address;
+
+		try
+		{
+			for (auto& backend : backends)
+			{
+				if (backend.address.starts_with(UNIX_ADDRESS_PREFIX))
+				{
+					backend.endpoint = asio::local::stream_protocol::endpoint{
+						backend.address.substr(UNIX_ADDRESS_PREFIX.size())};
+				}
+				else
+				{
+					const auto [host, port] = parseHostPort(backend.address, 8080);
+					auto results = resolver.resolve(host, std::to_string(port));
+					backend.endpoint = results.begin()->endpoint();
+				}
+			}
+		}
+		catch (const std::exception& e)
+		{
+			std::println(stderr, "Failed to resolve backends: {}", e.what());
+			std::fflush(stderr);
+			throw;
+		}
+	}
+
 	class Server final : public std::enable_shared_from_this<Server>
 	{
 	public:
-		explicit Server(const tcp::endpoint& listenEndpoint)
-			: acceptor(*ioc, listenEndpoint)
+		explicit Server(asio::io_context& ioc, const tcp::endpoint& listenEndpoint)
+			: acceptor(ioc)
 		{
+			acceptor.open(listenEndpoint.protocol());
 			acceptor.set_option(asio::socket_base::reuse_address(true));
-			acceptor.set_option(boost::asio::ip::tcp::no_delay(true));
 
-			resolveBackends();
+			// Each per-thread io_context has its own acceptor and the kernel shards connections among them
+			if (Config::ioContextPerThread)
+				acceptor.set_option(reuse_port(true));
+
+			acceptor.bind(listenEndpoint);
+			acceptor.listen();
+			acceptor.set_option(boost::asio::ip::tcp::no_delay(true));
 		}
 
 		Server(const Server&) = delete;
@@ -252,30 +322,6 @@ namespace
 		}
 
 	private:
-		void resolveBackends()
-		{
-			tcp::resolver resolver{*ioc};
-
-			backends[0].address = Config::backend0Address;
-			backends[1].address = Config::backend1Address;
-
-			try
-			{
-				for (auto& backend : backends)
-				{
-					const auto [host, port] = parseHostPort(backend.address, 8080);
-					auto results = resolver.resolve(host, std::to_string(port));
-					backend.endpoint = results.begin()->endpoint();
-				}
-			}
-			catch (const std::exception& e)
-			{
-				std::println(stderr, "Failed to resolve backends: {}", e.what());
-				std::fflush(stderr);
-				throw;
-			}
-		}
-
 		asio::awaitable<void> acceptConnections()
 		{
 			while (true)
@@ -313,23 +359,39 @@ namespace
 		tcp::acceptor acceptor;
 	};
 
+	void runIoContext(unsigned index)
+	{
+		if (Config::ioPinThreads)
+			pinCurrentThreadToCpu(index);
+
+		iocs[Config::ioContextPerThread ? index : 0]->run();
+	}
+
 	void run()
 	{
-		ioc = std::make_unique<asio::io_context>(Config::ioWorkers);
+		resolveBackends();
+
+		const unsigned iocCount = Config::ioContextPerThread ? Config::ioWorkers : 1;
+
+		for (unsigned i = 0; i < iocCount; ++i)
+			iocs.push_back(std::make_unique<asio::io_context>(Config::ioContextPerThread ? 1 : Config::ioWorkers));
 
 		const auto [ip, port] = parseHostPort(Config::listenAddress, 8080);
 		const auto endpoint = tcp::endpoint{asio::ip::make_address(ip), port};
 
-		auto server = std::make_shared<Server>(endpoint);
+		for (auto& ioc : iocs)
+		{
+			auto server = std::make_shared<Server>(*ioc, endpoint);
 
-		asio::co_spawn(
-			*ioc,
-			[server]() -> asio::awaitable<void>
-			{
-				// Start server
-				co_await server->start();
-			},
-			asio::detached);
+			asio::co_spawn(
+				*ioc,
+				[server]() -> asio::awaitable<void>
+				{
+					// Start server
+					co_await server->start();
+				},
+				asio::detached);
+		}
 
 		std::println("Server listening on {}", Config::listenAddress);
 		std::fflush(stdout);
@@ -340,11 +402,11 @@ namespace
 		for (unsigned i = 1; i < Config::ioWorkers; ++i)
 		{
 			threads.emplace_back(
-				[]
+				[i]
 				{
 					try
 					{
-						ioc->run();
+						runIoContext(i);
 					}
 					catch (const std::exception& e)
 					{
@@ -354,7 +416,7 @@ namespace
 				});
 		}
 
-		ioc->run();
+		runIoContext(0);
 
 		std::println("Proxy stopped");
 		std::fflush(stdout);
@@ -22,9 +22,14 @@ namespace rinhaback::api
 		static inline const auto ioWorkers = static_cast<unsigned>(std::stoul(readEnv("IO_WORKERS", "8")));
 		static inline const auto handlerWorkers = static_cast<unsigned>(std::stoul(readEnv("HANDLER_WORKERS", "8")));
 		static inline const auto database = readEnv("DATABASE", "/data/database");
-		static inline const auto databaseSize = static_cast<unsigned>(std::stoul(readEnv("DATABASE_SIZE", "10485760")));
+		static inline const auto databaseSize = static_cast<unsigned>(std::stoul(readEnv("DATABASE_SIZE", "0")));
+		static inline const auto expectedPaymentRate =
+			static_cast<unsigned>(std::stoul(readEnv("EXPECTED_PAYMENT_RATE", "300")));
 		static inline const auto coordinator = readEnv("COORDINATOR", "false") == "true";
+		static inline const auto instanceId = static_cast<unsigned>(std::stoul(readEnv("INSTANCE_ID", "0")));
 		static inline const auto listenAddress = readEnv("LISTEN_ADDRESS", "0.0.0.0:8080");
+		static inline const auto processorConcurrency =
+			static_cast<unsigned>(std::stoul(readEnv("PROCESSOR_CONCURRENCY", "64")));
 		static inline const auto processorDefaultAddress =
 			readEnv("PROCESSOR_DEFAULT_ADDRESS", "payment-processor-default:8080");
 		static inline const auto processorFallbackAddress =
@@ -1,94 +1,84 @@
 #include "./PaymentProcessor.h"
 #include "./Config.h"
 #include "./GatewayChooserService.h"
-#include "./SignalHandling.h"
 #include "./Util.h"
+#include "../common/LoadStats.h"
+#include <algorithm>
+#include <atomic>
 #include <format>
-#include <mutex>
 #include <print>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <cassert>
-#include "boost/asio.hpp"
-#include "boost/beast.hpp"
-#include "boost/url.hpp"
-#include "boost/url/parse.hpp"
-
-
-namespace asio = boost::asio;
-namespace beast = boost::beast;
-namespace http = boost::beast::http;
-using tcp = asio::ip::tcp;
+#include "drogon/drogon.h"
+#include "trantor/net/EventLoop.h"
 
 
 namespace rinhaback::api
 {
-	static std::once_flag resolverOnce;
-	static tcp::endpoint defaultEndpoint, fallbackEndpoint;
+	static const std::string defaultUrl = "http://" + Config::processorDefaultAddress;
+	static const std::string fallbackUrl = "http://" + Config::processorFallbackAddress;
 
-	std::jthread PaymentProcessor::start(boost::asio::io_context& ioc,
-		std::shared_ptr<PendingPaymentsQueue> pendingPaymentsQueue, std::shared_ptr<PaymentService> paymentService)
+	void PaymentProcessor::init()
 	{
-		const auto processor =
-			std::make_shared<PaymentProcessor>(ioc, std::move(pendingPaymentsQueue), std::move(paymentService));
+		idleClients.emplace();
 
-		return std::jthread(
-			[processor]()
-			{
-				asio::co_spawn(processor->ioc, processor->handler(), asio::detached);
-				processor->ioc.run();
-			});
+		std::println("PaymentProcessor started.");
+		std::fflush(stdout);
 	}
 
-	boost::asio::awaitable<void> PaymentProcessor::handler()
+	void PaymentProcessor::wakeUp()
 	{
-		std::println("PaymentProcessor started.");
-		std::fflush(stdout);
+		while (!pendingPaymentsQueue->empty() && tryAcquireWorker())
+			drogon::async_run([this] { return worker(); });
+	}
 
-		std::call_once(resolverOnce,
-			[&]
-			{
-				tcp::resolver resolver{ioc};
+	bool PaymentProcessor::tryAcquireWorker()
+	{
+		const auto maxWorkers = std::max(Config::processorConcurrency, 1u);
+		auto workers = activeWorkers.load(std::memory_order_relaxed);
 
-				{  // scope
-					const auto [host, port] = parseHostPort(Config::processorDefaultAddress, 8080);
-					defaultEndpoint = resolver.resolve(host, std::to_string(port)).begin()->endpoint();
-				}
+		while (workers < maxWorkers)
+		{
+			if (activeWorkers.compare_exchange_weak(workers, workers + 1, std::memory_order_acq_rel))
+				return true;
+		}
 
-				{  // scope
-					const auto [host, port] = parseHostPort(Config::processorFallbackAddress, 8080);
-					fallbackEndpoint = resolver.resolve(host, std::to_string(port)).begin()->endpoint();
-				}
-			});
+		return false;
+	}
+
+	drogon::Task<> PaymentProcessor::worker()
+	{
+		auto& instanceLoad = LoadStats::get().getInstance(Config::instanceId);
 
-		while (!SignalHandling::shouldFinish())
+		do
 		{
-			const auto optionalPayment = pendingPaymentsQueue->dequeue();
+			while (const auto payment = pendingPaymentsQueue->tryDequeue())
+			{
+				InFlightPaymentGuard inFlightGuard(instanceLoad);
+				co_await processPayment(payment.value());
+			}
 
-			if (optionalPayment.has_value())
-				co_await processPayment(optionalPayment.value());
-		}
+			activeWorkers.fetch_sub(1, std::memory_order_acq_rel);
 
-		std::println("PaymentProcessor stopped.");
-		std::fflush(stdout);
+			// A payment queued after the last tryDequeue may not have found a free worker
+		} while (!pendingPaymentsQueue->empty() && tryAcquireWorker());
 	}
 
-	boost::asio::awaitable<void> PaymentProcessor::processPayment(const PendingPaymentsQueue::Payment& payment)
+	drogon::Task<> PaymentProcessor::processPayment(const PendingPaymentsQueue::Payment& payment)
 	{
 		const auto gateway = GatewayChooserService::getGateway();
-		const std::string* host = nullptr;
-		const tcp::endpoint* endpoint = nullptr;
+		const std::string* url = nullptr;
 
 		switch (gateway)
 		{
 			case PaymentGateway::DEFAULT:
-				host = &Config::processorDefaultAddress;
-				endpoint = &defaultEndpoint;
+				url = &defaultUrl;
 				break;
 
 			case PaymentGateway::FALLBACK:
-				host = &Config::processorFallbackAddress;
-				endpoint = &fallbackEndpoint;
+				url = &fallbackUrl;
 				break;
 
 			default:
@@ -96,68 +86,70 @@ namespace rinhaback::api
 				co_return;
 		}
 
-		auto stream = std::make_shared<beast::tcp_stream>(ioc);
+		// The coroutine resumes on the loop of the client, so this is always the current loop storage
+		auto& clients = idleClients->getThreadData()[std::to_underlying(gateway)];
+		drogon::HttpClientPtr client;
 
-		try
+		if (clients.empty())
+			client = drogon::HttpClient::newHttpClient(*url, trantor::EventLoop::getEventLoopOfCurrentThread());
+		else
 		{
-			co_await stream->async_connect(*endpoint, asio::use_awaitable);
-
-			const auto requestedAt = getCurrentDateTime();
-			const auto jsonBody = std::format(R"({{"correlationId":"{}","amount":{:.2f},"requestedAt":"{:%FT%T}Z"}})",
-				std::string_view(payment.correlationId.data(), payment.correlationId.size()), payment.amount,
-				requestedAt);
+			client = std::move(clients.back());
+			clients.pop_back();
+		}
 
-			auto req = std::make_shared<http::request<http::string_body>>();
-			req->method(http::verb::post);
-			req->target("/payments");
-			req->set(http::field::host, *host);
-			req->set(http::field::content_type, HTTP_CONTENT_TYPE_JSON);
-			req->body() = jsonBody;
-			req->prepare_payload();
+		const auto requestedAt = getCurrentDateTime();
 
-			co_await http::async_write(*stream, *req, asio::use_awaitable);
+		auto request = drogon::HttpRequest::newHttpRequest();
+		request->setMethod(drogon::Post);
+		request->setPath("/payments");
+		request->setContentTypeCode(drogon::CT_APPLICATION_JSON);
+		request->setBody(std::format(R"({{"correlationId":"{}","amount":{:.2f},"requestedAt":"{:%FT%T}Z"}})",
+			std::string_view(payment.correlationId.data(), payment.correlationId.size()), payment.amount,
+			requestedAt));
 
-			auto buffer = std::make_shared<beast::flat_buffer>();
-			auto res = std::make_shared<http::response<http::string_body>>();
+		drogon::HttpResponsePtr response;
 
-			co_await http::async_read(*stream, *buffer, *res, asio::use_awaitable);
+		try
+		{
+			response = co_await client->sendRequestCoro(request);
+		}
+		catch (const std::exception& e)
+		{
+			std::println(stderr, "Payment processing error: {}", e.what());
+			std::fflush(stderr);
+			co_return;
+		}
 
-			boost::system::error_code shutdownEc;
-			stream->socket().shutdown(tcp::socket::shutdown_both, shutdownEc);
+		clients.push_back(std::move(client));
 
-			if (res->result() == http::status::ok)
-			{
-				if constexpr (false)
-				{
-					std::println("Payment processed successfully: correlationId: {}, amount: {}",
-						std::string_view(payment.correlationId.data(), payment.correlationId.size()), payment.amount);
-					std::fflush(stdout);
-				}
-
-				paymentService->postPayment(gateway, payment.amount, payment.correlationId, requestedAt);
-			}
-			else
+		if (response->statusCode() == drogon::k200OK)
+		{
+			if constexpr (false)
 			{
-				GatewayChooserService::switchGatewayTo(
-					gateway == PaymentGateway::DEFAULT ? PaymentGateway::FALLBACK : PaymentGateway::DEFAULT);
-
-				if constexpr (false)
-				{
-					std::println("Payment processing failed: gateway: {}, correlationId: {}, amount: {}, "
-								 "httpStatus: {}",
-						gateway, std::string_view(payment.correlationId.data(), payment.correlationId.size()),
-						payment.amount, (int) res->result());
-					std::fflush(stdout);
-				}
-
-				// Try again with the other gateway
-				co_await processPayment(payment);
+				std::println("Payment processed successfully: correlationId: {}, amount: {}",
+					std::string_view(payment.correlationId.data(), payment.correlationId.size()), payment.amount);
+				std::fflush(stdout);
 			}
+
+			paymentService->postPayment(gateway, payment.amount, payment.correlationId, requestedAt);
 		}
-		catch (const boost::system::system_error& e)
+		else
 		{
-			std::println(stderr, "Payment processing error: {}", e.what());
-			std::fflush(stderr);
+			GatewayChooserService::switchGatewayTo(
+				gateway == PaymentGateway::DEFAULT ? PaymentGateway::FALLBACK : PaymentGateway::DEFAULT);
+
+			if constexpr (false)
+			{
+				std::println("Payment processing failed: gateway: {}, correlationId: {}, amount: {}, "
+							 "httpStatus: {}",
+					gateway, std::string_view(payment.correlationId.data(), payment.correlationId.size()),
+					payment.amount, (int) response->statusCode());
+				std::fflush(stdout);
+			}
+
+			// Try again with the other gateway
+			co_await processPayment(payment);
 		}
 	}
 }  // namespace rinhaback::api
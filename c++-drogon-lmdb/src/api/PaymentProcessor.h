@@ -1,21 +1,32 @@
 #pragma once
 
+#include "./Database.h"
 #include "./PaymentService.h"
 #include "./PendingPaymentsQueue.h"
+#include <array>
+#include <atomic>
 #include <memory>
-#include <thread>
-#include "boost/asio.hpp"
+#include <optional>
+#include <utility>
+#include <vector>
+#include "drogon/HttpClient.h"
+#include "drogon/IOThreadStorage.h"
+#include "drogon/utils/coroutine.h"
 
 
 namespace rinhaback::api
 {
+	// Payments are sent by coroutines running on drogon's IO loops, up to PROCESSOR_CONCURRENCY at once. Each loop
+	// keeps the keep-alive clients of its finished requests for reuse by the next ones.
 	class PaymentProcessor final
 	{
+	private:
+		using IdleClients = std::array<std::vector<drogon::HttpClientPtr>, std::to_underlying(PaymentGateway::SIZE)>;
+
 	public:
-		PaymentProcessor(boost::asio::io_context& ioc, std::shared_ptr<PendingPaymentsQueue> pendingPaymentsQueue,
-			std::shared_ptr<PaymentService> paymentService)
-			: ioc(ioc),
-			  pendingPaymentsQueue(std::move(pendingPaymentsQueue)),
+		PaymentProcessor(
+			std::shared_ptr<PendingPaymentsQueue> pendingPaymentsQueue, std::shared_ptr<PaymentService> paymentService)
+			: pendingPaymentsQueue(std::move(pendingPaymentsQueue)),
 			  paymentService(std::move(paymentService))
 		{
 		}
@@ -24,16 +35,21 @@ namespace rinhaback::api
 		PaymentProcessor& operator=(const PaymentProcessor&) = delete;
 
 	public:
-		static std::jthread start(boost::asio::io_context& ioc,
-			std::shared_ptr<PendingPaymentsQueue> pendingPaymentsQueue, std::shared_ptr<PaymentService> paymentService);
+		// Must be called once the IO loops exist
+		void init();
+
+		// Starts workers on the calling IO loop while there are queued payments and the concurrency allows
+		void wakeUp();
 
 	private:
-		boost::asio::awaitable<void> handler();
-		boost::asio::awaitable<void> processPayment(const PendingPaymentsQueue::Payment& payment);
+		bool tryAcquireWorker();
+		drogon::Task<> worker();
+		drogon::Task<> processPayment(const PendingPaymentsQueue::Payment& payment);
 
 	private:
-		boost::asio::io_context& ioc;
 		std::shared_ptr<PendingPaymentsQueue> pendingPaymentsQueue;
 		std::shared_ptr<PaymentService> paymentService;
+		std::atomic_uint activeWorkers{0};
+		std::optional<drogon::IOThreadStorage<IdleClients>> idleClients;
 	};
 }  // namespace rinhaback::api
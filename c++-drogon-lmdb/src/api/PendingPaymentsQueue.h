@@ -1,12 +1,10 @@
 #pragma once
 
 #include "./SignalHandling.h"
-#include <chrono>
-#include <condition_variable>
+#include <atomic>
 #include <mutex>
 #include <optional>
 #include <queue>
-#include <cassert>
 #include <cstdint>
 
 
@@ -22,7 +20,12 @@ namespace rinhaback::api
 		};
 
 	public:
-		PendingPaymentsQueue() = default;
+		// The queue depth is kept in publishedSize, so it can be read without locking
+		explicit PendingPaymentsQueue(std::atomic_uint32_t& publishedSize)
+			: publishedSize(publishedSize)
+		{
+			publishedSize.store(0, std::memory_order_relaxed);
+		}
 
 		PendingPaymentsQueue(const PendingPaymentsQueue&) = delete;
 		PendingPaymentsQueue& operator=(const PendingPaymentsQueue&) = delete;
@@ -30,46 +33,48 @@ namespace rinhaback::api
 	public:
 		void enqueue(const Payment& payment)
 		{
-			{  // scope
-				std::unique_lock lock(mutex);
-				queue.push(payment);
-			}
-
-			condVar.notify_one();
+			std::unique_lock lock(mutex);
+			queue.push(payment);
+			publishSize();
 		}
 
-		std::optional<Payment> dequeue()
+		// Payments are pulled by the processor workers running on the IO loops, which must not block
+		std::optional<Payment> tryDequeue()
 		{
-			do
-			{
-				std::unique_lock lock(mutex);
-
-				if (!condVar.wait_for(lock, SignalHandling::WAIT_TIME, [&] { return !queue.empty(); }))
-				{
-					if (SignalHandling::shouldFinish())
-						return std::nullopt;
+			std::unique_lock lock(mutex);
 
-					continue;
-				}
+			if (queue.empty())
+				return std::nullopt;
 
-				assert(!queue.empty());
+			Payment payment = queue.front();
+			queue.pop();
+			publishSize();
 
-				Payment payment = queue.front();
-				queue.pop();
+			return payment;
+		}
 
-				return payment;
-			} while (true);
+		bool empty()
+		{
+			std::unique_lock lock(mutex);
+			return queue.empty();
 		}
 
 		void purge()
 		{
 			std::unique_lock lock(mutex);
 			queue = {};
+			publishSize();
+		}
+
+	private:
+		void publishSize()
+		{
+			publishedSize.store(static_cast<uint32_t>(queue.size()), std::memory_order_relaxed);
 		}
 
 	private:
 		std::mutex mutex;
-		std::condition_variable condVar;
 		std::queue<Payment> queue;
+		std::atomic_uint32_t& publishedSize;
 	};
 }  // namespace rinhaback::api
@@ -2,31 +2,30 @@
 #include "./PaymentProcessor.h"
 #include "./Config.h"
 #include "./GatewayChooserService.h"
+#include "./PaymentRequestParser.h"
 #include "./PaymentService.h"
 #include "./PendingPaymentsQueue.h"
 #include "./SignalHandling.h"
 #include "./Util.h"
+#include "../common/LoadStats.h"
 #include <format>
 #include <memory>
 #include <optional>
 #include <print>
 #include <string>
 #include <thread>
-#include "boost/asio.hpp"
 #include "boost/json.hpp"
 #include "drogon/drogon.h"
 
 
-namespace asio = boost::asio;
-using tcp = asio::ip::tcp;
-
-
 namespace
 {
+	using namespace rinhaback;
 	using namespace rinhaback::api;
 
 	std::shared_ptr<PaymentService> paymentService{std::make_shared<PaymentService>()};
-	std::shared_ptr<PendingPaymentsQueue> pendingPaymentsQueue{std::make_shared<PendingPaymentsQueue>()};
+	std::shared_ptr<PendingPaymentsQueue> pendingPaymentsQueue;
+	std::shared_ptr<PaymentProcessor> paymentProcessor;
 
 	void paymentsSummaryHandler(
 		const drogon::HttpRequestPtr& request, std::function<void(const drogon::HttpResponsePtr&)>&& callback)
@@ -57,6 +56,28 @@ namespace
 	void postPaymentHandler(
 		const drogon::HttpRequestPtr& request, std::function<void(const drogon::HttpResponsePtr&)>&& callback)
 	{
+		PendingPaymentsQueue::Payment parsedPayment;
+
+		switch (PaymentRequestParser::parse(request->body(), parsedPayment))
+		{
+			case PaymentRequestParser::Result::OK:
+				pendingPaymentsQueue->enqueue(parsedPayment);
+				paymentProcessor->wakeUp();
+				callback(drogon::HttpResponse::newHttpResponse());
+				return;
+
+			case PaymentRequestParser::Result::INVALID:
+			{
+				auto response = drogon::HttpResponse::newHttpResponse();
+				response->setStatusCode(drogon::HttpStatusCode::k400BadRequest);
+				callback(response);
+				return;
+			}
+
+			case PaymentRequestParser::Result::FALLBACK:
+				break;
+		}
+
 		auto inJsonObj = boost::json::parse(request->body()).as_object();
 		const auto& correlationIdJson = inJsonObj["correlationId"];
 		const auto amountJson = inJsonObj["amount"];
@@ -73,6 +94,7 @@ namespace
 					correlationId.data(), pendingPayment.correlationId.size(), pendingPayment.correlationId.begin());
 
 				pendingPaymentsQueue->enqueue(pendingPayment);
+				paymentProcessor->wakeUp();
 
 				callback(drogon::HttpResponse::newHttpResponse());
 				return;
@@ -95,23 +117,26 @@ namespace
 
 	void run()
 	{
+		// Not at namespace scope, so an invalid INSTANCE_ID is reported by main like any other startup error
+		auto& instanceLoad = LoadStats::get().getInstance(Config::instanceId);
+
+		// Payments in flight when a previous run of this instance stopped
+		instanceLoad.inFlightPayments.store(0, std::memory_order_relaxed);
+
+		pendingPaymentsQueue = std::make_shared<PendingPaymentsQueue>(instanceLoad.pendingPayments);
+		paymentProcessor = std::make_shared<PaymentProcessor>(pendingPaymentsQueue, paymentService);
+
 		std::vector<std::jthread> threads;
 
 		if (Config::coordinator)
 			threads.emplace_back(GatewayChooserService::start());
 
-		threads.emplace_back(
-			[]
-			{
-				asio::io_context processorIoc;
-				PaymentProcessor::start(processorIoc, pendingPaymentsQueue, paymentService);
-				processorIoc.run();
-			});
-
 		getConnection();
 
 		const auto [ip, port] = parseHostPort(Config::listenAddress, 8080);
 
+		drogon::app().registerBeginningAdvice([] { paymentProcessor->init(); });
+
 		drogon::app().registerHandler("/payments-summary",
 			[](const drogon::HttpRequestPtr& request, std::function<void(const drogon::HttpResponsePtr&)>&& callback)
 			{ paymentsSummaryHandler(request, std::move(callback)); }, {drogon::Get});
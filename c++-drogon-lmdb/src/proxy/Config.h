@@ -1,6 +1,7 @@
 #pragma once
 
 #include <string>
+#include <cstddef>
 #include <cstdlib>
 
 
@@ -23,5 +24,8 @@ namespace rinhaback::proxy
 		static inline const auto listenAddress = readEnv("LISTEN_ADDRESS", "0.0.0.0:9999");
 		static inline const auto backend0Address = readEnv("BACKEND_0_ADDRESS", "localhost:8001");
 		static inline const auto backend1Address = readEnv("BACKEND_1_ADDRESS", "localhost:8002");
+		static inline const auto pipeliningDepth =
+			static_cast<std::size_t>(std::stoul(readEnv("BACKEND_PIPELINING_DEPTH", "64")));
+		static inline const auto balanceByLoad = readEnv("BALANCE_BY_LOAD", "false") == "true";
 	};
 }  // namespace rinhaback::proxy
@@ -1,14 +1,18 @@
 #include "mimalloc-new-delete.h"
 #include "./Config.h"
 #include "./Util.h"
+#include "../common/LoadStats.h"
+#include <array>
 #include <atomic>
 #include <functional>
+#include <optional>
 #include <print>
 #include <stdexcept>
 #include <string>
 #include "boost/asio.hpp"
 #include "drogon/drogon.h"
 #include "drogon/HttpClient.h"
+#include "drogon/IOThreadStorage.h"
 
 namespace asio = boost::asio;
 using tcp = asio::ip::tcp;
@@ -16,6 +20,7 @@ using tcp = asio::ip::tcp;
 
 namespace
 {
+	using namespace rinhaback;
 	using namespace rinhaback::proxy;
 
 	struct Backend final
@@ -54,71 +59,71 @@ namespace
 		}
 	}
 
-	const Backend& getBackend()
+	// One keep-alive client per backend on each IO loop, so forwarded requests never cross threads nor open
+	// connections per request. Created when the app starts, as the storage is sized by the number of IO threads.
+	std::optional<drogon::IOThreadStorage<std::array<drogon::HttpClientPtr, 2>>> clients;
+
+	void createClients(std::array<drogon::HttpClientPtr, 2>& loopClients, size_t loopIndex)
 	{
-		size_t backendIndex = nextBackend.fetch_add(1) % backends.size();
-		return backends[backendIndex];
+		const auto loop = loopIndex < drogon::app().getThreadNum() ? drogon::app().getIOLoop(loopIndex)
+																	: drogon::app().getLoop();
+
+		for (size_t i = 0; i < backends.size(); ++i)
+		{
+			const auto& endpoint = backends[i].endpoint;
+
+			loopClients[i] =
+				drogon::HttpClient::newHttpClient(endpoint.address().to_string(), endpoint.port(), false, loop);
+			loopClients[i]->setPipeliningDepth(Config::pipeliningDepth);
+		}
 	}
 
-	void proxyRequest(
-		const drogon::HttpRequestPtr& request, std::function<void(const drogon::HttpResponsePtr&)>&& callback)
+	// Payments go to the API instance with the smallest backlog, backend N being the instance with INSTANCE_ID N.
+	// Ties and other requests are balanced round robin.
+	size_t chooseBackend(bool payment)
 	{
-		const auto& backend = getBackend();
+		const size_t first = nextBackend.fetch_add(1) % backends.size();
 
-		// Create HTTP client for the target server
-		auto client =
-			drogon::HttpClient::newHttpClient(backend.endpoint.address().to_string(), backend.endpoint.port());
+		if (!payment || !Config::balanceByLoad)
+			return first;
 
-		// Create a new request to forward
-		auto forwardReq = drogon::HttpRequest::newHttpRequest();
-		forwardReq->setMethod(request->getMethod());
-		forwardReq->setPath(request->getPath());
+		auto& loadStats = LoadStats::get();
+		size_t best = first;
+		auto bestLoad = loadStats.getInstance(first).getLoad();
 
-		// Copy query parameters
-		auto& params = request->getParameters();
-		for (const auto& param : params)
-			forwardReq->setParameter(param.first, param.second);
-
-		// Copy headers (excluding Host header which will be set by the client)
-		auto& headers = request->getHeaders();
-		for (const auto& header : headers)
+		for (size_t i = 1; i < backends.size(); ++i)
 		{
-			if (header.first != "host" && header.first != "Host")
-				forwardReq->addHeader(header.first, header.second);
+			const auto index = (first + i) % backends.size();
+
+			if (const auto load = loadStats.getInstance(index).getLoad(); load < bestLoad)
+			{
+				best = index;
+				bestLoad = load;
+			}
 		}
 
-		// Copy request body if present
-		if (request->getBody().length() > 0)
-			forwardReq->setBody(std::string(request->getBody()));
+		return best;
+	}
+
+	// The received request and the backend response are passed through as they are, so neither the headers nor
+	// the body are copied
+	void proxyRequest(
+		const drogon::HttpRequestPtr& request, std::function<void(const drogon::HttpResponsePtr&)>&& callback)
+	{
+		const auto& client = clients->getThreadData()[chooseBackend(false)];
+
+		request->setPassThrough(true);
 
-		// Forward the request
-		client->sendRequest(forwardReq,
+		client->sendRequest(request,
 			[callback = std::move(callback)](drogon::ReqResult result, const drogon::HttpResponsePtr& response)
 			{
 				if (result == drogon::ReqResult::Ok && response)
 				{
-					// Forward the response back to the client
-					auto resp = drogon::HttpResponse::newHttpResponse();
-					resp->setStatusCode(response->getStatusCode());
-					resp->setBody(std::string(response->getBody()));
-
-					// Copy response headers
-					auto& responseHeaders = response->getHeaders();
-					for (const auto& header : responseHeaders)
-					{
-						// Skip headers that might cause issues
-						if (header.first != "transfer-encoding" && header.first != "Transfer-Encoding" &&
-							header.first != "connection" && header.first != "Connection")
-						{
-							resp->addHeader(header.first, header.second);
-						}
-					}
-
-					callback(resp);
+					response->setPassThrough(true);
+					callback(response);
 				}
 				else
 				{
-					// Handle error case
 					auto errorResp = drogon::HttpResponse::newHttpResponse();
 					errorResp->setStatusCode(drogon::HttpStatusCode::k502BadGateway);
 					callback(errorResp);
@@ -131,36 +136,11 @@ namespace
 	{
 		callback(drogon::HttpResponse::newHttpResponse());
 
-		const auto& backend = getBackend();
+		const auto& client = clients->getThreadData()[chooseBackend(true)];
 
-		// Create HTTP client for the target server
-		auto client =
-			drogon::HttpClient::newHttpClient(backend.endpoint.address().to_string(), backend.endpoint.port());
+		request->setPassThrough(true);
 
-		// Create a new request to forward
-		auto forwardReq = drogon::HttpRequest::newHttpRequest();
-		forwardReq->setMethod(request->getMethod());
-		forwardReq->setPath(request->getPath());
-
-		// Copy query parameters
-		auto& params = request->getParameters();
-		for (const auto& param : params)
-			forwardReq->setParameter(param.first, param.second);
-
-		// Copy headers (excluding Host header which will be set by the client)
-		auto& headers = request->getHeaders();
-		for (const auto& header : headers)
-		{
-			if (header.first != "host" && header.first != "Host")
-				forwardReq->addHeader(header.first, header.second);
-		}
-
-		// Copy request body if present
-		if (request->getBody().length() > 0)
-			forwardReq->setBody(std::string(request->getBody()));
-
-		// Forward the request
-		client->sendRequest(forwardReq, [](drogon::ReqResult result, const drogon::HttpResponsePtr& response) { });
+		client->sendRequest(request, [](drogon::ReqResult result, const drogon::HttpResponsePtr& response) { });
 	}
 
 	void run()
@@ -169,6 +149,13 @@ namespace
 
 		const auto [ip, port] = parseHostPort(Config::listenAddress, 8080);
 
+		drogon::app().registerBeginningAdvice(
+			[]
+			{
+				clients.emplace();
+				clients->init(createClients);
+			});
+
 		drogon::app().setDefaultHandler(
 			[](const drogon::HttpRequestPtr& request, std::function<void(const drogon::HttpResponsePtr&)>&& callback)
 			{ proxyRequest(request, std::move(callback)); });
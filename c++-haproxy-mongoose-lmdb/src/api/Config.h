@@ -22,10 +22,17 @@ namespace rinhaback::api
 		static inline const auto serverWorkers = (unsigned) std::stoi(readEnv("SERVER_WORKERS", "1"));
 		static inline const auto serverPollTime = (unsigned) std::stoi(readEnv("SERVER_POLL_TIME", "1"));
 		static inline const auto processorWorkers = (unsigned) std::stoi(readEnv("PROCESSOR_WORKERS", "1"));
+		static inline const auto processorConcurrency = (unsigned) std::stoi(readEnv("PROCESSOR_CONCURRENCY", "64"));
+		static inline const auto processorPollTime = (unsigned) std::stoi(readEnv("PROCESSOR_POLL_TIME", "1"));
+		static inline const auto summaryWorkers = (unsigned) std::stoi(readEnv("SUMMARY_WORKERS", "1"));
 		static inline const auto database = readEnv("DATABASE", "/data/database");
-		static inline const auto databaseSize = (unsigned) std::stoi(readEnv("DATABASE_SIZE", "10485760"));
+		static inline const auto databaseSize = (unsigned) std::stoi(readEnv("DATABASE_SIZE", "0"));
+		static inline const auto expectedPaymentRate = (unsigned) std::stoi(readEnv("EXPECTED_PAYMENT_RATE", "300"));
 		static inline const auto databaseInit = readEnv("DATABASE_INIT", "false") == "true";
 		static inline const auto listenAddress = readEnv("LISTEN_ADDRESS", "0.0.0.0:8080");
+		static inline const auto listenUnixPath = readEnv("LISTEN_UNIX_PATH", "");
+		static inline const auto agentListenAddress = readEnv("AGENT_LISTEN_ADDRESS", "");
+		static inline const auto agentHalfWeightLoad = (unsigned) std::stoi(readEnv("AGENT_HALF_WEIGHT_LOAD", "100"));
 		static inline const auto processorDefaultUrl =
 			readEnv("PROCESSOR_DEFAULT_URL", "http://payment-processor-default:8080");
 		static inline const auto processorFallbackUrl =
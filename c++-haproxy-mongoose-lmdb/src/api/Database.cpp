@@ -1,8 +1,14 @@
 #include "./Database.h"
 #include "./Config.h"
 #include "./Util.h"
+#include <algorithm>
 #include <bit>
 #include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <print>
+#include <string>
 #include <thread>
 #include <cstring>
 
@@ -11,6 +17,52 @@ namespace stdfs = std::filesystem;
 
 namespace rinhaback::api
 {
+	static constexpr std::size_t MAP_SIZE_ALIGNMENT = 1024 * 1024;
+
+	// The initial map holds the payments expected in this time
+	static constexpr std::size_t INITIAL_MAP_SECONDS = 120;
+
+	// Stored size of a payment, including its share of the B-tree pages
+	static constexpr std::size_t PAYMENT_MAP_BYTES = 64;
+
+	// Memory limit of the container, from cgroup v2 or v1
+	static std::optional<std::size_t> getMemoryLimit()
+	{
+		for (const auto path : {"/sys/fs/cgroup/memory.max", "/sys/fs/cgroup/memory/memory.limit_in_bytes"})
+		{
+			std::ifstream file(path);
+			std::string value;
+
+			if (file >> value && value != "max")
+				return static_cast<std::size_t>(std::stoull(value));
+		}
+
+		return std::nullopt;
+	}
+
+	// DATABASE_SIZE when set, or room for the payments expected at EXPECTED_PAYMENT_RATE. With MDB_WRITEMAP the used
+	// pages of the map are charged to the container memory, so it's also limited to a quarter of it. The map grows
+	// when it becomes full.
+	static std::size_t getInitialMapSize()
+	{
+		if (Config::databaseSize != 0)
+			return Config::databaseSize;
+
+		auto size = std::size_t{Config::expectedPaymentRate} * INITIAL_MAP_SECONDS * PAYMENT_MAP_BYTES;
+
+		if (const auto memoryLimit = getMemoryLimit())
+			size = std::min(size, *memoryLimit / 4);
+
+		return std::max((size + MAP_SIZE_ALIGNMENT - 1) / MAP_SIZE_ALIGNMENT * MAP_SIZE_ALIGNMENT, MAP_SIZE_ALIGNMENT);
+	}
+
+	static std::size_t getMapSize(MDB_env* env)
+	{
+		MDB_envinfo info;
+		checkMdbError(mdb_env_info(env, &info));
+		return info.me_mapsize;
+	}
+
 	Connection::Connection()
 	{
 		if (Config::databaseInit)
@@ -29,13 +81,19 @@ namespace rinhaback::api
 		const int endiannessFlags = std::endian::native == std::endian::little ? (MDB_REVERSEKEY | MDB_REVERSEDUP) : 0;
 
 		checkMdbError(mdb_env_create(&env));
-		checkMdbError(mdb_env_set_mapsize(env, Config::databaseSize));
+
+		// Others take the current size of the existing database
+		if (Config::databaseInit)
+			checkMdbError(mdb_env_set_mapsize(env, getInitialMapSize()));
+
 		checkMdbError(mdb_env_set_maxdbs(env, std::to_underlying(PaymentGateway::SIZE)));
 		checkMdbError(mdb_env_open(env, Config::database.c_str(),
 			MDB_WRITEMAP | MDB_NOMETASYNC | MDB_NOSYNC | MDB_NOTLS | MDB_NOMEMINIT |
 				(Config::databaseInit ? MDB_CREATE : 0),
 			0664));
 
+		mapSize = getMapSize(env);
+
 		Transaction transaction(*this, 0);
 
 		checkMdbError(
@@ -47,6 +105,33 @@ namespace rinhaback::api
 				&dbis[std::to_underlying(PaymentGateway::FALLBACK)]));
 	}
 
+	void Connection::growMap(std::size_t fullMapSize)
+	{
+		std::unique_lock lock(mapMutex);
+
+		if (mapSize != fullMapSize)
+			return;
+
+		// Another process may have grown it already
+		checkMdbError(mdb_env_set_mapsize(env, 0));
+
+		if (getMapSize(env) <= fullMapSize)
+			checkMdbError(mdb_env_set_mapsize(env, fullMapSize * 2));
+
+		mapSize = getMapSize(env);
+
+		std::println("Database map grown to {} bytes.", mapSize);
+		std::fflush(stdout);
+	}
+
+	void Connection::adoptMapSize()
+	{
+		std::unique_lock lock(mapMutex);
+
+		checkMdbError(mdb_env_set_mapsize(env, 0));
+		mapSize = getMapSize(env);
+	}
+
 	Connection::~Connection()
 	{
 		for (auto dbi : dbis)
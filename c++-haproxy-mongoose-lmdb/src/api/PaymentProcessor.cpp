@@ -3,16 +3,70 @@
 #include "./GatewayChooserService.h"
 #include "./SignalHandling.h"
 #include "./Util.h"
+#include <algorithm>
+#include <array>
 #include <format>
 #include <print>
 #include <string>
 #include <string_view>
+#include <utility>
 #include <cassert>
-#include "httplib.h"
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
 
 
 namespace rinhaback::api
 {
+	namespace
+	{
+		struct GatewayEndpoint
+		{
+			std::string url;
+			std::string host;
+		};
+	}  // namespace
+
+	// mongoose resolves names with its own DNS client, which doesn't know the container network names, so
+	// the gateways are resolved once with the system resolver and connected to by address.
+	static GatewayEndpoint resolveGatewayEndpoint(const std::string& url)
+	{
+		const auto mgHost = mg_url_host(url.c_str());
+		const std::string host(mgHost.buf, mgHost.len);
+		const auto port = mg_url_port(url.c_str());
+
+		GatewayEndpoint endpoint{.url = url, .host = std::format("{}:{}", host, port)};
+
+		addrinfo hints{.ai_family = AF_INET, .ai_socktype = SOCK_STREAM};
+		addrinfo* result = nullptr;
+
+		if (getaddrinfo(host.c_str(), nullptr, &hints, &result) == 0)
+		{
+			std::array<char, INET_ADDRSTRLEN> address;
+			inet_ntop(AF_INET, &reinterpret_cast<const sockaddr_in*>(result->ai_addr)->sin_addr, address.data(),
+				address.size());
+			freeaddrinfo(result);
+
+			endpoint.url = std::format("http://{}:{}", address.data(), port);
+		}
+		else
+			std::println(stderr, "Cannot resolve {}", host);
+
+		return endpoint;
+	}
+
+	static const GatewayEndpoint& getGatewayEndpoint(PaymentGateway gateway)
+	{
+		static const std::array<GatewayEndpoint, std::to_underlying(PaymentGateway::SIZE)> endpoints = {
+			resolveGatewayEndpoint(Config::processorDefaultUrl),
+			resolveGatewayEndpoint(Config::processorFallbackUrl),
+		};
+
+		assert(gateway < PaymentGateway::SIZE);
+		return endpoints[std::to_underlying(gateway)];
+	}
+
 	std::jthread PaymentProcessor::start(
 		std::shared_ptr<PendingPaymentsQueue> pendingPaymentsQueue, std::shared_ptr<PaymentService> paymentService)
 	{
@@ -27,18 +81,60 @@ namespace rinhaback::api
 	{
 		std::println("PaymentProcessor started.");
 
+		mg_mgr_init(&mgr);
+
+		requests.resize(std::max(Config::processorConcurrency, 1u));
+		idleRequests.reserve(requests.size());
+		retryRequests.reserve(requests.size());
+
+		for (auto& request : requests)
+		{
+			request.processor = this;
+			idleRequests.push_back(&request);
+		}
+
 		while (!SignalHandling::shouldFinish())
 		{
-			const auto optionalPayment = pendingPaymentsQueue->dequeue();
+			// Only block on the queue when there is nothing in flight, otherwise the event loop must keep running
+			if (idleRequests.size() == requests.size())
+			{
+				if (const auto payment = pendingPaymentsQueue->dequeue())
+					startPayment(payment.value());
+			}
 
-			if (optionalPayment.has_value())
-				processPayment(optionalPayment.value());
+			while (!idleRequests.empty())
+			{
+				const auto payment = pendingPaymentsQueue->tryDequeue();
+
+				if (!payment.has_value())
+					break;
+
+				startPayment(payment.value());
+			}
+
+			mg_mgr_poll(&mgr, Config::processorPollTime);
+
+			if (idleRequests.size() != requests.size())
+				expireRequests();
+
+			// Retries wait for the next poll, so a gateway refusing connections doesn't make this loop spin
+			const auto retryCount = retryRequests.size();
+
+			for (std::size_t i = 0; i < retryCount; ++i)
+			{
+				retryRequests[i]->retrying = false;
+				startRequest(*retryRequests[i]);
+			}
+
+			retryRequests.erase(retryRequests.begin(), retryRequests.begin() + retryCount);
 		}
 
+		mg_mgr_free(&mgr);
+
 		std::println("PaymentProcessor stopped.");
 	}
 
-	void PaymentProcessor::processPayment(const PendingPaymentsQueue::Payment& payment)
+	void PaymentProcessor::startPayment(const PendingPaymentsQueue::Payment& payment)
 	{
 		if constexpr (false)
 		{
@@ -46,76 +142,168 @@ namespace rinhaback::api
 				std::string_view(payment.correlationId.data(), payment.correlationId.size()), payment.amount);
 		}
 
-		std::optional<httplib::Client> httpClient;
-		const std::string* url = nullptr;
+		assert(!idleRequests.empty());
+
+		auto& request = *idleRequests.back();
+		idleRequests.pop_back();
+
+		request.payment = payment;
+		inFlightPayments.fetch_add(1, std::memory_order_relaxed);
+
+		startRequest(request);
+	}
+
+	void PaymentProcessor::startRequest(Request& request)
+	{
+		const auto gateway = GatewayChooserService::getGateway();
+
+		if (request.conn && (request.connGateway != gateway || request.conn->is_closing))
+			closeConnection(request);
+
+		request.gateway = gateway;
+		request.deadline = std::chrono::steady_clock::now() + REQUEST_TIMEOUT;
 
-		do
+		if (request.conn)
 		{
-			const auto gateway = GatewayChooserService::getGateway();
-			const std::string* oldUrl = url;
+			// Otherwise the request is sent by MG_EV_CONNECT
+			if (!request.conn->is_connecting)
+				sendRequest(request, request.conn);
 
-			switch (gateway)
-			{
-				case PaymentGateway::DEFAULT:
-					url = &Config::processorDefaultUrl;
-					break;
+			return;
+		}
 
-				case PaymentGateway::FALLBACK:
-					url = &Config::processorFallbackUrl;
-					break;
+		request.connGateway = gateway;
+		request.conn = mg_http_connect(&mgr, getGatewayEndpoint(gateway).url.c_str(), connectionHandler, &request);
 
-				default:
-					assert(false);
-					break;
+		if (!request.conn)
+		{
+			request.retrying = true;
+			retryRequests.push_back(&request);
+		}
+	}
+
+	void PaymentProcessor::sendRequest(Request& request, mg_connection* conn)
+	{
+		const auto& payment = request.payment.value();
+
+		request.requestedAt = getCurrentDateTime();
+
+		std::array<char, 2000> json;
+		const auto jsonFormatResult = std::format_to_n(json.begin(), json.size(),
+			R"({{"correlationId":"{}","amount":{:.2f},"requestedAt":"{:%FT%T}Z"}})",
+			std::string_view(payment.correlationId.data(), payment.correlationId.size()), payment.amount,
+			request.requestedAt);
+
+		mg_printf(conn,
+			"POST /payments HTTP/1.1\r\n"
+			"Host: %s\r\n"
+			"Content-Type: %s\r\n"
+			"Content-Length: %u\r\n"
+			"\r\n",
+			getGatewayEndpoint(request.gateway).host.c_str(), HTTP_CONTENT_TYPE_JSON.c_str(),
+			static_cast<unsigned>(jsonFormatResult.size));
+		mg_send(conn, json.data(), jsonFormatResult.size);
+	}
+
+	void PaymentProcessor::completeRequest(Request& request, int httpStatus)
+	{
+		const auto& payment = request.payment.value();
+
+		if (httpStatus == HTTP_STATUS_OK)
+		{
+			if constexpr (false)
+			{
+				std::println("Payment processed successfully: correlationId: {}, amount: {}",
+					std::string_view(payment.correlationId.data(), payment.correlationId.size()), payment.amount);
 			}
 
-			if (!oldUrl || url != oldUrl)
+			paymentService->postPayment(request.gateway, payment.amount, payment.correlationId, request.requestedAt);
+		}
+		else if (httpStatus == -1 || (httpStatus >= 500 && httpStatus <= 599))
+		{
+			request.retrying = true;
+			retryRequests.push_back(&request);
+			return;
+		}
+		else
+		{
+			GatewayChooserService::switchGatewayTo(
+				request.gateway == PaymentGateway::DEFAULT ? PaymentGateway::FALLBACK : PaymentGateway::DEFAULT);
+
+			if constexpr (false)
 			{
-				httpClient = httplib::Client(*url);
-				httpClient->set_keep_alive(true);
+				std::println("Payment processing failed: correlationId: {}, amount: {}, httpStatus: {}",
+					std::string_view(payment.correlationId.data(), payment.correlationId.size()), payment.amount,
+					httpStatus);
 			}
+		}
 
-			const auto requestedAt = getCurrentDateTime();
+		request.payment.reset();
+		idleRequests.push_back(&request);
+		inFlightPayments.fetch_sub(1, std::memory_order_relaxed);
+	}
 
-			std::array<char, 2000> json;
-			const auto jsonFormatResult = std::format_to_n(json.begin(), json.size(),
-				R"({{"correlationId":"{}","amount":{:.2f},"requestedAt":"{:%FT%T}Z"}})",
-				std::string_view(payment.correlationId.data(), payment.correlationId.size()), payment.amount,
-				requestedAt);
+	void PaymentProcessor::closeConnection(Request& request)
+	{
+		request.conn->fn_data = nullptr;
+		request.conn->is_closing = 1;
+		request.conn = nullptr;
+	}
 
-			const auto httpResponse =
-				httpClient->Post("/payments", json.data(), jsonFormatResult.size, HTTP_CONTENT_TYPE_JSON);
-			const int httpStatus = httpResponse ? httpResponse->status : -1;
+	// Requests without a response in time have their connection dropped, as it may be half-dead, and are retried
+	void PaymentProcessor::expireRequests()
+	{
+		const auto now = std::chrono::steady_clock::now();
 
-			if (httpStatus == HTTP_STATUS_OK)
-			{
-				if constexpr (false)
-				{
-					std::println("Payment processed successfully: correlationId: {}, amount: {}",
-						std::string_view(payment.correlationId.data(), payment.correlationId.size()), payment.amount);
-				}
+		for (auto& request : requests)
+		{
+			if (!request.payment.has_value() || request.retrying || now < request.deadline)
+				continue;
 
-				paymentService->postPayment(gateway, payment.amount, payment.correlationId, requestedAt);
+			if (request.conn)
+				closeConnection(request);
 
-				return;
-			}
-			else
-			{
-				if (!(httpStatus == -1 || (httpStatus >= 500 && httpStatus <= 599)))
+			completeRequest(request, -1);
+		}
+	}
+
+	void PaymentProcessor::connectionHandler(mg_connection* conn, int ev, void* evData)
+	{
+		const auto request = static_cast<Request*>(conn->fn_data);
+
+		// Detached by closeConnection
+		if (!request)
+			return;
+
+		const bool active = request->payment.has_value() && !request->retrying;
+
+		switch (ev)
+		{
+			case MG_EV_CONNECT:
+				if (active)
+					request->processor->sendRequest(*request, conn);
+				break;
+
+			case MG_EV_HTTP_MSG:
+				if (active)
 				{
-					GatewayChooserService::switchGatewayTo(
-						gateway == PaymentGateway::DEFAULT ? PaymentGateway::FALLBACK : PaymentGateway::DEFAULT);
+					const auto httpMessage = static_cast<mg_http_message*>(evData);
+					request->processor->completeRequest(*request, mg_http_status(httpMessage));
+				}
+				break;
 
-					if constexpr (false)
-					{
-						std::println("Payment processing failed: correlationId: {}, amount: {}, httpStatus: {}",
-							std::string_view(payment.correlationId.data(), payment.correlationId.size()),
-							payment.amount, httpStatus);
-					}
+			case MG_EV_CLOSE:
+				if (request->conn == conn)
+				{
+					request->conn = nullptr;
 
-					break;
+					if (active)
+						request->processor->completeRequest(*request, -1);
 				}
-			}
-		} while (true);
+				break;
+
+			default:
+				break;
+		}
 	}
 }  // namespace rinhaback::api
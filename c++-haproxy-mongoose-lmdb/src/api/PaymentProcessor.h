@@ -1,15 +1,37 @@
 #pragma once
 
+#include "./Database.h"
 #include "./PaymentService.h"
 #include "./PendingPaymentsQueue.h"
+#include "./Util.h"
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include <optional>
 #include <thread>
+#include <vector>
+#include "mongoose.h"
 
 
 namespace rinhaback::api
 {
+	// Each processor thread runs its own mongoose event loop with up to PROCESSOR_CONCURRENCY payments in flight.
+	// Every in-flight slot owns a keep-alive connection to the gateway it last sent to.
 	class PaymentProcessor final
 	{
+	private:
+		struct Request final
+		{
+			PaymentProcessor* processor = nullptr;
+			mg_connection* conn = nullptr;
+			PaymentGateway connGateway = PaymentGateway::DEFAULT;
+			std::optional<PendingPaymentsQueue::Payment> payment;
+			PaymentGateway gateway = PaymentGateway::DEFAULT;
+			DateTimeMillis requestedAt;
+			std::chrono::steady_clock::time_point deadline;
+			bool retrying = false;
+		};
+
 	public:
 		PaymentProcessor() = default;
 
@@ -20,12 +42,36 @@ namespace rinhaback::api
 		static std::jthread start(
 			std::shared_ptr<PendingPaymentsQueue> pendingPaymentsQueue, std::shared_ptr<PaymentService> paymentService);
 
+		// Number of payments being sent to a gateway by all processors
+		static unsigned getInFlightPayments()
+		{
+			return inFlightPayments.load(std::memory_order_relaxed);
+		}
+
+	private:
+		// Same as the default read timeout of cpp-httplib, so a gateway that never answers releases the slot
+		static constexpr std::chrono::seconds REQUEST_TIMEOUT{5};
+
 	private:
 		void handler();
-		void processPayment(const PendingPaymentsQueue::Payment& payment);
+		void startPayment(const PendingPaymentsQueue::Payment& payment);
+		void startRequest(Request& request);
+		void sendRequest(Request& request, mg_connection* conn);
+		void completeRequest(Request& request, int httpStatus);
+		void closeConnection(Request& request);
+		void expireRequests();
+
+		static void connectionHandler(mg_connection* conn, int ev, void* evData);
 
 	private:
+		static inline std::atomic_uint inFlightPayments{0};
+
 		std::shared_ptr<PendingPaymentsQueue> pendingPaymentsQueue;
 		std::shared_ptr<PaymentService> paymentService;
+
+		mg_mgr mgr;
+		std::vector<Request> requests;
+		std::vector<Request*> idleRequests;
+		std::vector<Request*> retryRequests;
 	};
 }  // namespace rinhaback::api
@@ -19,18 +19,41 @@ namespace rinhaback::api
 
 		PaymentData data{.amount = amount, .correlationId = correlationId};
 
-		Transaction transaction(connection, 0);
-
 		MDB_val mdbKey(sizeof(key), &key);
 		MDB_val mdbData(sizeof(data), &data);
-		checkMdbError(mdb_put(transaction.txn, connection.dbis[std::to_underlying(gateway)], &mdbKey, &mdbData, 0));
+
+		while (true)
+		{
+			Transaction transaction(connection, 0);
+			const auto dbi = connection.dbis[std::to_underlying(gateway)];
+
+			// Timestamps mostly arrive in order, and appending skips the B-tree descent and fills the last page
+			// instead of splitting it in half. Keys not after the last one, including a repeated last key, are
+			// refused with MDB_KEYEXIST and take the regular path.
+			int rc = mdb_put(transaction.txn, dbi, &mdbKey, &mdbData, MDB_APPEND);
+
+			if (rc == MDB_KEYEXIST)
+				rc = mdb_put(transaction.txn, dbi, &mdbKey, &mdbData, 0);
+
+			if (rc == 0)
+				rc = transaction.commit();
+			else
+				transaction.abort();
+
+			if (rc != MDB_MAP_FULL)
+			{
+				checkMdbError(rc);
+				break;
+			}
+
+			// Written again after the map is grown
+			connection.growMap(transaction.mapSize);
+		}
 	}
 
 	PaymentRepository::PaymentsGatewaySummaryResponse PaymentRepository::getPaymentsSummary(
-		Transaction& transaction, std::optional<std::int64_t> from, std::optional<std::int64_t> to)
+		ReadTransaction& transaction, std::optional<std::int64_t> from, std::optional<std::int64_t> to)
 	{
-		Connection& connection = transaction.connection;
-
 		PaymentsGatewaySummaryResponse response = {
 			.totalRequests = 0,
 			.totalAmount = 0.0,
@@ -41,15 +64,13 @@ namespace rinhaback::api
 		MDB_val mdbKey(sizeof(initialKey), &initialKey);
 		MDB_val mdbData;
 
-		MDB_cursor* cursor;
-		checkMdbError(mdb_cursor_open(transaction.txn, connection.dbis[std::to_underlying(gateway)], &cursor));
+		// Owned by the transaction cache, so it's not closed here
+		const auto cursor = transaction.getCursor(gateway);
 
 		int rc = mdb_cursor_get(cursor, &mdbKey, &mdbData, (from ? MDB_SET_RANGE : MDB_FIRST));
 
 		if (rc != 0)
 		{
-			mdb_cursor_close(cursor);
-
 			if (rc != MDB_NOTFOUND)
 				checkMdbError(rc);
 
@@ -73,8 +94,6 @@ namespace rinhaback::api
 			rc = mdb_cursor_get(cursor, &mdbKey, &mdbData, MDB_NEXT);
 		}
 
-		mdb_cursor_close(cursor);
-
 		if (rc != MDB_NOTFOUND)
 			checkMdbError(rc);
 
@@ -42,7 +42,7 @@ namespace rinhaback::api
 		void postPayment(double amount, const CorrelationId& correlationId, DateTimeMillis requestedAt);
 
 		PaymentsGatewaySummaryResponse getPaymentsSummary(
-			Transaction& transaction, std::optional<std::int64_t> from, std::optional<std::int64_t> to);
+			ReadTransaction& transaction, std::optional<std::int64_t> from, std::optional<std::int64_t> to);
 
 		void purge();
 
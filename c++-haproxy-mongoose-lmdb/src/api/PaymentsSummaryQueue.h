@@ -0,0 +1,73 @@
+#pragma once
+
+#include "./SignalHandling.h"
+#include "./Util.h"
+#include <condition_variable>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <cassert>
+#include "mongoose.h"
+
+
+namespace rinhaback::api
+{
+	// GET /payments-summary requests waiting for a summary worker. The reply goes back to the connection through
+	// mg_wakeup on the manager that owns it.
+	class PaymentsSummaryQueue final
+	{
+	public:
+		struct Request
+		{
+			mg_mgr* mgr;
+			unsigned long connId;
+			std::optional<DateTimeMillis> from;
+			std::optional<DateTimeMillis> to;
+		};
+
+	public:
+		PaymentsSummaryQueue() = default;
+
+		PaymentsSummaryQueue(const PaymentsSummaryQueue&) = delete;
+		PaymentsSummaryQueue& operator=(const PaymentsSummaryQueue&) = delete;
+
+	public:
+		void enqueue(const Request& request)
+		{
+			{  // scope
+				std::unique_lock lock(mutex);
+				queue.push(request);
+			}
+
+			condVar.notify_one();
+		}
+
+		std::optional<Request> dequeue()
+		{
+			do
+			{
+				std::unique_lock lock(mutex);
+
+				if (!condVar.wait_for(lock, SignalHandling::WAIT_TIME, [&] { return !queue.empty(); }))
+				{
+					if (SignalHandling::shouldFinish())
+						return std::nullopt;
+
+					continue;
+				}
+
+				assert(!queue.empty());
+
+				Request request = queue.front();
+				queue.pop();
+
+				return request;
+			} while (true);
+		}
+
+	private:
+		std::mutex mutex;
+		std::condition_variable condVar;
+		std::queue<Request> queue;
+	};
+}  // namespace rinhaback::api
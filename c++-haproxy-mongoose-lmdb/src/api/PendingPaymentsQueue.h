@@ -7,6 +7,7 @@
 #include <optional>
 #include <queue>
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
 
 
@@ -61,6 +62,25 @@ namespace rinhaback::api
 			} while (true);
 		}
 
+		std::optional<Payment> tryDequeue()
+		{
+			std::unique_lock lock(mutex);
+
+			if (queue.empty())
+				return std::nullopt;
+
+			Payment payment = queue.front();
+			queue.pop();
+
+			return payment;
+		}
+
+		std::size_t size()
+		{
+			std::unique_lock lock(mutex);
+			return queue.size();
+		}
+
 		void purge()
 		{
 			std::unique_lock lock(mutex);
@@ -9,6 +9,7 @@
 namespace rinhaback::api
 {
 	inline constexpr int HTTP_STATUS_OK = 200;
+	inline constexpr int HTTP_STATUS_BAD_REQUEST = 400;
 	inline constexpr int HTTP_STATUS_UNPROCESSABLE_CONTENT = 422;
 	inline constexpr int HTTP_STATUS_INTERNAL_SERVER_ERROR = 500;
 
@@ -2,22 +2,36 @@
 #include "./PaymentProcessor.h"
 #include "./Config.h"
 #include "./GatewayChooserService.h"
+#include "./PaymentRequestParser.h"
+#include "./PaymentsSummaryQueue.h"
 #include "./PendingPaymentsQueue.h"
 #include "./SignalHandling.h"
 #include "./Util.h"
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <chrono>
 #include <exception>
 #include <format>
+#include <latch>
 #include <memory>
 #include <optional>
 #include <print>
 #include <span>
+#include <stdexcept>
 #include <string>
 #include <string_view>
+#include <system_error>
 #include <thread>
 #include <vector>
 #include <experimental/scope>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
 #include "mongoose.h"
 #include "yyjson.h"
 
@@ -34,6 +48,100 @@ namespace rinhaback::api
 
 	static std::shared_ptr<PaymentService> paymentService{std::make_shared<PaymentService>()};
 	static std::shared_ptr<PendingPaymentsQueue> pendingPaymentsQueue{std::make_shared<PendingPaymentsQueue>()};
+	static std::shared_ptr<PaymentsSummaryQueue> paymentsSummaryQueue{std::make_shared<PaymentsSummaryQueue>()};
+
+	// Whether the manager polled by this server thread hands summaries to the summary workers, which need its
+	// wakeup to reply
+	static thread_local bool queueSummaries = false;
+
+	static std::size_t formatPaymentsSummary(
+		std::span<char> json, const PaymentService::PaymentsSummaryResponse& summary)
+	{
+		const auto& defaultGateway = summary.defaultGateway;
+		const auto& fallbackGateway = summary.fallbackGateway;
+
+		return std::format_to_n(json.begin(), json.size(),
+			R"({{"default":{{"totalRequests":{},"totalAmount":{:.2f}}},)"
+			R"("fallback":{{"totalRequests":{},"totalAmount":{:.2f}}}}})",
+			defaultGateway.totalRequests, defaultGateway.totalAmount, fallbackGateway.totalRequests,
+			fallbackGateway.totalAmount)
+			.size;
+	}
+
+	// Runs the summaries queued by the server threads, so their LMDB scans don't hold up the other connections of
+	// the event loop. An empty reply tells the connection the summary failed.
+	static void paymentsSummaryWorker()
+	{
+		while (const auto request = paymentsSummaryQueue->dequeue())
+		{
+			std::array<char, 2000> json{};
+			std::size_t length = 0;
+
+			try
+			{
+				const auto summary = paymentService->getPaymentsSummary(request->from, request->to);
+				length = formatPaymentsSummary(json, summary);
+			}
+			catch (const std::exception& e)
+			{
+				std::println(stderr, "{}", e.what());
+			}
+
+			// The server threads only free their managers after the summary workers exit
+			mg_wakeup(request->mgr, request->connId, json.data(), length);
+		}
+	}
+
+	// Generic POST /payments handling for bodies PaymentRequestParser does not recognize
+	static void postPaymentFallbackHandler(mg_connection* conn, mg_http_message* httpMessage)
+	{
+		int statusCode = HTTP_STATUS_UNPROCESSABLE_CONTENT;
+
+		const auto inDocJson = yyjson_read(httpMessage->body.buf, httpMessage->body.len, 0);
+
+		std::experimental::scope_exit scopeExit(
+			[&]()
+			{
+				if (statusCode != HTTP_STATUS_OK)
+					mg_http_reply(conn, statusCode, RESPONSE_HEADERS, "");
+
+				yyjson_doc_free(inDocJson);
+			});
+
+		const auto inRootJson = yyjson_doc_get_root(inDocJson);
+		const auto correlationIdJson = yyjson_obj_get(inRootJson, "correlationId");
+		const auto amountJson = yyjson_obj_get(inRootJson, "amount");
+
+		if (yyjson_is_str(correlationIdJson) && yyjson_is_num(amountJson))
+		{
+			const std::span correlationId(yyjson_get_str(correlationIdJson), yyjson_get_len(correlationIdJson));
+			const auto amount = yyjson_get_num(amountJson);
+
+			if (correlationId.size() == std::tuple_size<CorrelationId>() && amount > 0)
+			{
+				statusCode = HTTP_STATUS_OK;
+				mg_http_reply(conn, statusCode, RESPONSE_HEADERS, "");
+
+				PendingPaymentsQueue::Payment pendingPayment = {.amount = amount};
+				std::copy_n(
+					correlationId.data(), pendingPayment.correlationId.size(), pendingPayment.correlationId.begin());
+
+				pendingPaymentsQueue->enqueue(pendingPayment);
+			}
+		}
+	}
+
+	// mongoose only listens on TCP/UDP URLs. To serve HTTP over a Unix socket, an acceptor thread takes its
+	// connections and hands them round robin to the server threads through mg_wakeup on their HTTP listeners. They
+	// wrap them with mg_wrapfd, and as wrapped connections have no protocol handler, unixHttpHandler frames their
+	// requests with mg_http_parse.
+	struct UnixHandoffTarget final
+	{
+		std::atomic<mg_mgr*> mgr = nullptr;
+		unsigned long connId = 0;
+	};
+
+	static void unixHttpHandler(mg_connection* conn, int ev, void* evData);
 
 	static void httpHandler(mg_connection* conn, int ev, void* evData)
 	{
@@ -54,9 +162,14 @@ namespace rinhaback::api
 				if (isGet && mg_match(httpMessage->uri, MG_PAYMENTS_SUMMARY_PATH, nullptr))
 				{
 					Response response;
+					bool queued = false;
 
-					std::experimental::scope_exit scopeExit([&]()
-						{ mg_http_reply(conn, response.statusCode, RESPONSE_HEADERS, "%s", response.json.begin()); });
+					std::experimental::scope_exit scopeExit(
+						[&]()
+						{
+							if (!queued)
+								mg_http_reply(conn, response.statusCode, RESPONSE_HEADERS, "%s", response.json.begin());
+						});
 
 					std::optional<DateTimeMillis> from, to;
 					char queryParamBuffer[100];
@@ -67,57 +180,33 @@ namespace rinhaback::api
 					if (mg_http_get_var(&httpMessage->query, "to", queryParamBuffer, sizeof(queryParamBuffer)) > 0)
 						to = parseDateTime(queryParamBuffer);
 
-					const auto summary = paymentService->getPaymentsSummary(from, to);
-
-					const auto& defaultGateway = summary.defaultGateway;
-					const auto& fallbackGateway = summary.fallbackGateway;
-
-					std::format_to_n(response.json.begin(), response.json.size(),
-						R"({{"default":{{"totalRequests":{},"totalAmount":{:.2f}}},)"
-						R"("fallback":{{"totalRequests":{},"totalAmount":{:.2f}}}}})",
-						defaultGateway.totalRequests, defaultGateway.totalAmount, fallbackGateway.totalRequests,
-						fallbackGateway.totalAmount);
-
-					response.statusCode = HTTP_STATUS_OK;
+					if (queueSummaries)
+					{
+						paymentsSummaryQueue->enqueue({.mgr = conn->mgr, .connId = conn->id, .from = from, .to = to});
+						queued = true;
+					}
+					else
+					{
+						const auto summary = paymentService->getPaymentsSummary(from, to);
+						formatPaymentsSummary(response.json, summary);
+						response.statusCode = HTTP_STATUS_OK;
+					}
 				}
 				else if (isPost && mg_match(httpMessage->uri, MG_PAYMENTS_PATH, nullptr))
 				{
-					Response response;
-					response.statusCode = HTTP_STATUS_UNPROCESSABLE_CONTENT;
+					PendingPaymentsQueue::Payment pendingPayment;
+					const auto parseResult = PaymentRequestParser::parse(
+						std::string_view(httpMessage->body.buf, httpMessage->body.len), pendingPayment);
 
-					const auto inDocJson = yyjson_read(httpMessage->body.buf, httpMessage->body.len, 0);
-
-					std::experimental::scope_exit scopeExit(
-						[&]()
-						{
-							if (response.statusCode != HTTP_STATUS_OK)
-								mg_http_reply(conn, response.statusCode, RESPONSE_HEADERS, "");
-
-							yyjson_doc_free(inDocJson);
-						});
-
-					const auto inRootJson = yyjson_doc_get_root(inDocJson);
-					const auto correlationIdJson = yyjson_obj_get(inRootJson, "correlationId");
-					const auto amountJson = yyjson_obj_get(inRootJson, "amount");
-
-					if (yyjson_is_str(correlationIdJson) && yyjson_is_num(amountJson))
+					if (parseResult == PaymentRequestParser::Result::OK)
 					{
-						const std::span correlationId(
-							yyjson_get_str(correlationIdJson), yyjson_get_len(correlationIdJson));
-						const auto amount = yyjson_get_num(amountJson);
-
-						if (correlationId.size() == std::tuple_size<CorrelationId>() && amount > 0)
-						{
-							response.statusCode = HTTP_STATUS_OK;
-							mg_http_reply(conn, response.statusCode, RESPONSE_HEADERS, "");
-
-							PendingPaymentsQueue::Payment pendingPayment = {.amount = amount};
-							std::copy_n(correlationId.data(), pendingPayment.correlationId.size(),
-								pendingPayment.correlationId.begin());
-
-							pendingPaymentsQueue->enqueue(pendingPayment);
-						}
+						mg_http_reply(conn, HTTP_STATUS_OK, RESPONSE_HEADERS, "");
+						pendingPaymentsQueue->enqueue(pendingPayment);
 					}
+					else if (parseResult == PaymentRequestParser::Result::INVALID)
+						mg_http_reply(conn, HTTP_STATUS_UNPROCESSABLE_CONTENT, RESPONSE_HEADERS, "");
+					else
+						postPaymentFallbackHandler(conn, httpMessage);
 				}
 				else if (isPost && mg_match(httpMessage->uri, MG_PURGE_PAYMENTS_PATH, nullptr))
 				{
@@ -132,6 +221,31 @@ namespace rinhaback::api
 						MG_ESC("error"), MG_ESC("Unsupported URI"));
 				}
 			}
+			else if (ev == MG_EV_WAKEUP && conn->is_listening)
+			{
+				// A Unix socket connection from the acceptor thread
+				const auto data = static_cast<const mg_str*>(evData);
+				int fd;
+				std::memcpy(&fd, data->buf, sizeof(fd));
+
+				if (!mg_wrapfd(conn->mgr, fd, unixHttpHandler, nullptr))
+				{
+					std::println(stderr, "Cannot wrap Unix socket connection");
+					close(fd);
+				}
+			}
+			else if (ev == MG_EV_WAKEUP)
+			{
+				const auto json = static_cast<const mg_str*>(evData);
+
+				if (json->len != 0)
+				{
+					mg_http_reply(conn, HTTP_STATUS_OK, RESPONSE_HEADERS, "%.*s", static_cast<int>(json->len),
+						json->buf);
+				}
+				else
+					mg_http_reply(conn, HTTP_STATUS_INTERNAL_SERVER_ERROR, RESPONSE_HEADERS, "");
+			}
 		}
 		catch (const std::exception& e)
 		{
@@ -143,12 +257,143 @@ namespace rinhaback::api
 		}
 	}
 
+	static void unixHttpHandler(mg_connection* conn, int ev, void* evData)
+	{
+		// Other events, like the summary replies, are handled as for TCP connections
+		if (ev != MG_EV_READ)
+		{
+			httpHandler(conn, ev, evData);
+			return;
+		}
+
+		while (conn->recv.len != 0 && !conn->is_draining && !conn->is_closing)
+		{
+			mg_http_message httpMessage;
+			const int headerLength =
+				mg_http_parse(reinterpret_cast<const char*>(conn->recv.buf), conn->recv.len, &httpMessage);
+
+			// Headers not fully received yet
+			if (headerLength == 0)
+				return;
+
+			// Malformed, or a body without Content-Length, which HAProxy's clients don't send
+			if (headerLength < 0 || httpMessage.body.len == static_cast<std::size_t>(-1))
+			{
+				mg_http_reply(conn, HTTP_STATUS_BAD_REQUEST, RESPONSE_HEADERS, "");
+				conn->is_draining = 1;
+				mg_iobuf_del(&conn->recv, 0, conn->recv.len);
+				return;
+			}
+
+			if (conn->recv.len < httpMessage.message.len)
+				return;
+
+			httpHandler(conn, MG_EV_HTTP_MSG, &httpMessage);
+			mg_iobuf_del(&conn->recv, 0, httpMessage.message.len);
+		}
+	}
+
+	static int listenUnix(const std::string& path)
+	{
+		sockaddr_un address{.sun_family = AF_UNIX};
+
+		if (path.size() >= sizeof(address.sun_path))
+			throw std::runtime_error("Unix socket path too long: " + path);
+
+		std::copy(path.begin(), path.end(), address.sun_path);
+
+		const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+		if (fd == -1)
+			throw std::system_error(errno, std::generic_category(), "Unix socket creation");
+
+		unlink(path.c_str());
+
+		if (bind(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0 ||
+			listen(fd, SOMAXCONN) != 0)
+		{
+			const int error = errno;
+			close(fd);
+			throw std::system_error(error, std::generic_category(), "Unix socket listen on " + path);
+		}
+
+		// HAProxy does not run as root and needs write permission on the socket to connect
+		chmod(path.c_str(), 0666);
+
+		std::println("Server listening on unix:{}", path);
+
+		return fd;
+	}
+
+	static void unixAcceptor(int listenerFd, std::vector<UnixHandoffTarget>& targets)
+	{
+		constexpr int WAIT_MILLIS =
+			std::chrono::duration_cast<std::chrono::milliseconds>(SignalHandling::WAIT_TIME).count();
+
+		pollfd listenerPoll{.fd = listenerFd, .events = POLLIN};
+		std::size_t next = 0;
+
+		while (!SignalHandling::shouldFinish())
+		{
+			if (poll(&listenerPoll, 1, WAIT_MILLIS) <= 0)
+				continue;
+
+			int fd;
+
+			while ((fd = accept4(listenerFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC)) != -1)
+			{
+				bool handedOver = false;
+
+				// Server threads without a wakeup are skipped
+				for (std::size_t i = 0; i < targets.size() && !handedOver; ++i)
+				{
+					const auto& target = targets[next++ % targets.size()];
+
+					if (const auto mgr = target.mgr.load(std::memory_order_acquire))
+						handedOver = mg_wakeup(mgr, target.connId, &fd, sizeof(fd));
+				}
+
+				if (!handedOver)
+					close(fd);
+			}
+
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+				std::println(stderr, "Unix socket accept: {}", std::generic_category().message(errno));
+		}
+
+		close(listenerFd);
+	}
+
+	// HAProxy agent check: every connection gets a single line with the weight for this instance, as a percentage
+	// of the configured one. It halves when the backlog (queued plus in-flight payments) reaches
+	// AGENT_HALF_WEIGHT_LOAD. Gateway health is shared by all instances, so it does not change their relative
+	// weights and is not reported.
+	static void agentHandler(mg_connection* conn, int ev, void* evData)
+	{
+		if (ev == MG_EV_ACCEPT)
+		{
+			const auto load = pendingPaymentsQueue->size() + PaymentProcessor::getInFlightPayments();
+			const auto halfWeightLoad = std::max(Config::agentHalfWeightLoad, 1u);
+			const auto weight = std::max<std::size_t>(100 * halfWeightLoad / (halfWeightLoad + load), 1);
+
+			mg_printf(conn, "up %u%%\n", static_cast<unsigned>(weight));
+			conn->is_draining = 1;
+		}
+	}
+
 	static int run(int argc, const char* argv[])
 	{
 		SignalHandling::install();
 
+		const int unixListenerFd = Config::listenUnixPath.empty() ? -1 : listenUnix(Config::listenUnixPath);
+		std::vector<UnixHandoffTarget> unixHandoffTargets(Config::serverWorkers);
+
+		// Summary workers and the Unix socket acceptor wake up the managers of the server threads, which are freed
+		// only after they exit
+		std::latch wakeupSendersExited(Config::summaryWorkers + (unixListenerFd != -1 ? 1 : 0));
+
 		std::vector<std::jthread> threads;
-		threads.reserve(1 + Config::processorWorkers + Config::serverWorkers);
+		threads.reserve(2 + Config::processorWorkers + Config::summaryWorkers + Config::serverWorkers);
 
 		if (Config::databaseInit)
 			threads.emplace_back(GatewayChooserService::start());
@@ -156,18 +401,62 @@ namespace rinhaback::api
 		for (unsigned i = 0; i < Config::processorWorkers; ++i)
 			threads.emplace_back(PaymentProcessor::start(pendingPaymentsQueue, paymentService));
 
+		for (unsigned i = 0; i < Config::summaryWorkers; ++i)
+		{
+			threads.emplace_back(
+				[&wakeupSendersExited]
+				{
+					paymentsSummaryWorker();
+					wakeupSendersExited.count_down();
+				});
+		}
+
+		if (unixListenerFd != -1)
+		{
+			threads.emplace_back(
+				[unixListenerFd, &unixHandoffTargets, &wakeupSendersExited]
+				{
+					unixAcceptor(unixListenerFd, unixHandoffTargets);
+					wakeupSendersExited.count_down();
+				});
+		}
+
 		for (unsigned i = 0; i < Config::serverWorkers; ++i)
 		{
 			threads.emplace_back(
-				[]
+				[i, unixListenerFd, &unixHandoffTargets, &wakeupSendersExited]
 				{
 					mg_mgr mgr;
 					mg_mgr_init(&mgr);
-					mg_http_listen(&mgr, Config::listenAddress.c_str(), httpHandler, nullptr);
+
+					const bool wakeup =
+						(Config::summaryWorkers != 0 || unixListenerFd != -1) && mg_wakeup_init(&mgr);
+
+					queueSummaries = wakeup && Config::summaryWorkers != 0;
+
+					if (!wakeup && Config::summaryWorkers != 0)
+						std::println(stderr, "Cannot initialize mongoose wakeup, summaries are answered inline");
+
+					const auto listener = mg_http_listen(&mgr, Config::listenAddress.c_str(), httpHandler, nullptr);
+
+					if (listener && wakeup && unixListenerFd != -1)
+					{
+						unixHandoffTargets[i].connId = listener->id;
+						unixHandoffTargets[i].mgr.store(&mgr, std::memory_order_release);
+					}
+
+					if (i == 0 && !Config::agentListenAddress.empty())
+					{
+						if (mg_listen(&mgr, Config::agentListenAddress.c_str(), agentHandler, nullptr))
+							std::println("Agent listening on {}", Config::agentListenAddress);
+						else
+							std::println(stderr, "Cannot listen agent on {}", Config::agentListenAddress);
+					}
 
 					while (!SignalHandling::shouldFinish())
 						mg_mgr_poll(&mgr, Config::serverPollTime);
 
+					wakeupSendersExited.wait();
 					mg_mgr_free(&mgr);
 				});
 		}